@@ -1,11 +1,17 @@
-
 SRC := $(wildcard examples/*.b)
-OBJ := $(SRC:.b=.urcl)
-
-.PHONY: all FORCE
-all: $(OBJ)
+FAILING := $(wildcard examples/failing/*.b)
+JOBS ?= 8
+CHECK_DIR ?= examples/.check
 
-%.urcl: %.b FORCE
-	bcc $< -o $@
+.PHONY: all
+all:
+	bcc --each $(SRC) --outdir examples -j$(JOBS)
 
-FORCE:
+.PHONY: check
+# the failing inputs must be reported on their own without stopping the rest of the batch
+check:
+	mkdir -p $(CHECK_DIR)
+	! bcc --each $(SRC) $(FAILING) --outdir $(CHECK_DIR) -j$(JOBS) 2> $(CHECK_DIR)/batch.log
+	grep -q "^\[BATCH\]: $(words $(SRC)) succeeded, $(words $(FAILING)) failed$$" $(CHECK_DIR)/batch.log
+	for input in $(FAILING); do grep -q "^\[BATCH\]: FAILED $$input$$" $(CHECK_DIR)/batch.log || exit 1; done
+	for input in $(SRC); do test -s $(CHECK_DIR)/$$(basename $$input .b).urcl || exit 1; done
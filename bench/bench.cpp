@@ -0,0 +1,217 @@
+
+#include "synthetic.hpp"
+#include "src/lexer.hpp"
+#include "src/ir.hpp"
+#include "src/compiler.hpp"
+#include "src/report.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <charconv>
+
+namespace fs = std::filesystem;
+
+static inline int PrintUsage()
+{
+    std::cout << "[USAGE]:\n    bcc-bench [--functions <n>] [--depth <n>] [--expression <n>] [--strings <n>] [--asm-lines <n>]";
+    std::cout << "\n              [--repeat <n>] [-j <jobs>] [--dump <file>] [--baseline <file>] [--tolerance <percent>]";
+    return 1;
+}
+
+struct Options
+{
+    Synthetic::Parameters program;
+    size_t repeat = 5;
+    size_t jobs = 1;
+    double tolerance = 10;
+    std::string dumpFile;
+    std::string baselineFile;
+};
+
+// Every benchmark runs over the whole synthetic program, throughput is counted in its source lines and tokens
+struct Result
+{
+    std::string name;
+    double seconds;
+};
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string str = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "[CLI ERROR]: No value given after " << str << "!\n";
+            return false;
+        }
+        std::string value = argv[++i];
+        if (str == "--dump") {
+            options.dumpFile = value;
+            continue;
+        }
+        if (str == "--baseline") {
+            options.baselineFile = value;
+            continue;
+        }
+
+        size_t number = 0;
+        auto parsed = std::from_chars(value.data(), value.data() + value.size(), number);
+        if (value.empty() || parsed.ec != std::errc() || parsed.ptr != value.data() + value.size()) {
+            std::cerr << "[CLI ERROR]: Invalid number after " << str << "!\n";
+            return false;
+        }
+        if (str == "--functions") {
+            options.program.functions = number;
+        } else if (str == "--depth") {
+            options.program.depth = number;
+        } else if (str == "--expression") {
+            options.program.expression = std::max<size_t>(number, 1);
+        } else if (str == "--strings") {
+            options.program.strings = number;
+        } else if (str == "--asm-lines") {
+            options.program.asmLines = number;
+        } else if (str == "--repeat") {
+            options.repeat = std::max<size_t>(number, 1);
+        } else if (str == "-j") {
+            options.jobs = std::max<size_t>(number, 1);
+        } else if (str == "--tolerance") {
+            options.tolerance = number;
+        } else {
+            std::cerr << "[CLI ERROR]: Unknown option " << str << "!\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// the best of several runs, the others mostly measure whatever else the machine was doing
+static double Best(size_t repeat, const std::function<double()>& run)
+{
+    double best = run();
+    for (size_t i = 1; i < repeat; ++i) {
+        best = std::min(best, run());
+    }
+    return best;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Regression Gate, tokens/s of the benchmarks present in both runs is compared, lines vary too much in length
+static double BaselineRate(const std::string& baseline, const std::string& name)
+{
+    std::istringstream lines(baseline);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.find("\"benchmark\": \"" + name + "\"") == std::string::npos)
+            continue;
+        size_t found = line.find("\"tokens_per_s\": ");
+        if (found != std::string::npos)
+            return std::stod(line.substr(found + 16));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+        return PrintUsage();
+
+    std::string baseline;
+    if (!options.baselineFile.empty()) {
+        std::ifstream file(options.baselineFile);
+        if (!file) {
+            std::cerr << "[FATAL ERROR]: could not read baseline '" << options.baselineFile << "'\n";
+            return 1;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        baseline = stream.str();
+    }
+
+    std::string source = Synthetic::Program(options.program);
+    if (!options.dumpFile.empty()) {
+        std::ofstream(options.dumpFile) << source;
+    }
+
+    size_t lines = std::count(source.begin(), source.end(), '\n');
+    size_t tokens = Lexer().Tokenize(source).size() - 1;
+
+    IRGenerator checkGen;
+    IRInfo irInfo = checkGen.Generate(source);
+    if (checkGen.PrintErrors())
+        return 1;
+
+    std::string outputPath = (fs::temp_directory_path() / ("bcc-bench-" + std::to_string(std::hash<std::string>()(source)) + ".urcl")).string();
+    std::vector<Result> results;
+
+    results.push_back({"lex", Best(options.repeat, [&] {
+        auto start = std::chrono::steady_clock::now();
+        Lexer lexer;
+        volatile size_t count = lexer.Tokenize(source).size();
+        (void)count;
+        return Seconds(start);
+    })});
+
+    results.push_back({"generate", Best(options.repeat, [&] {
+        auto start = std::chrono::steady_clock::now();
+        IRGenerator irGen;
+        IRInfo generated = irGen.Generate(source);
+        return Seconds(start);
+    })});
+
+    // the optimizer runs function by function inside the compile, the report adds its share up
+    double optimize = 0;
+    results.push_back({"compile", Best(options.repeat, [&] {
+        std::vector<IRInfo> toLink = {irInfo};
+        Report report;
+        Compiler compiler;
+        compiler.SetJobs(options.jobs);
+        compiler.SetReport(&report);
+        auto start = std::chrono::steady_clock::now();
+        compiler.LinkAndCompile(std::move(toLink), outputPath);
+        double seconds = Seconds(start);
+        optimize = optimize ? std::min(optimize, report.Seconds("optimize")) : report.Seconds("optimize");
+        return seconds;
+    })});
+    results.push_back({"optimize", optimize});
+
+    results.push_back({"end to end", Best(options.repeat, [&] {
+        auto start = std::chrono::steady_clock::now();
+        IRGenerator irGen;
+        std::vector<IRInfo> toLink;
+        toLink.push_back(irGen.Generate(source));
+        Compiler compiler;
+        compiler.SetJobs(options.jobs);
+        compiler.LinkAndCompile(std::move(toLink), outputPath);
+        return Seconds(start);
+    })});
+
+    std::error_code error;
+    fs::remove(outputPath, error);
+
+    // One JSON object per line, the same lines can be handed back as a --baseline
+    size_t regressions = 0;
+    for (auto& result: results) {
+        double seconds = std::max(result.seconds, 1e-9);
+        double rate = tokens / seconds;
+        std::cout << "{\"benchmark\": \"" << result.name << "\", \"functions\": " << options.program.functions
+                  << ", \"lines\": " << lines << ", \"tokens\": " << tokens << ", \"bytes\": " << source.size()
+                  << ", \"seconds\": " << result.seconds << ", \"lines_per_s\": " << (uint64_t)(lines / seconds)
+                  << ", \"tokens_per_s\": " << (uint64_t)rate << "}\n";
+
+        double previous = baseline.empty() ? 0 : BaselineRate(baseline, result.name);
+        if (previous > 0 && rate < previous * (1 - options.tolerance / 100)) {
+            std::cerr << "[BENCH]: " << result.name << " regressed to " << (uint64_t)rate << " tokens/s from " << (uint64_t)previous << "\n";
+            regressions += 1;
+        }
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "synthetic.hpp"
+
+#include <string_view>
+
+static const std::string_view OPERATORS[] = {" + ", " - ", " * ", " + ", " < ", " == ", " - ", " > "};
+static const std::string_view ASM_LINES[] = {
+    "llod r1 sp 1",
+    "llod r2 sp 2",
+    "add r1 r1 r2",
+    "mov r3 r1",
+    "imm r4 7",
+    "sub r1 r3 r4",
+    "mov r2 r2",
+    "add r1 r1 r4",
+};
+
+// Emitters, `seed` only varies the shapes so neighbouring functions are not identical
+static std::string Term(size_t seed)
+{
+    switch (seed % 4) {
+        case 0: return "a";
+        case 1: return "b";
+        case 2: return "x";
+        default: return std::to_string(seed % 97);
+    }
+}
+
+static std::string Expression(size_t terms, size_t seed)
+{
+    std::string expression = Term(seed);
+    for (size_t i = 1; i < terms; ++i) {
+        size_t shape = seed + i * 7;
+        expression += OPERATORS[shape % 8];
+        if (shape % 5 == 0 && i + 1 < terms) {
+            expression += "(" + Term(shape) + " + " + Term(shape + 1) + ")";
+            i += 1;
+        } else {
+            expression += Term(shape);
+        }
+    }
+    return expression;
+}
+
+static void Block(std::string& out, const Synthetic::Parameters& parameters, size_t depth, size_t seed, const std::string& indent)
+{
+    out += indent + "x = " + Expression(parameters.expression, seed) + ";\n";
+    if (depth == 0)
+        return;
+
+    if (depth % 2 == 0) {
+        out += indent + "if (" + Expression(3, seed + depth) + ") {\n";
+        Block(out, parameters, depth - 1, seed + 1, indent + "    ");
+        out += indent + "} else {\n";
+        out += indent + "    y = y + " + std::to_string(depth) + ";\n";
+        out += indent + "}\n";
+    } else {
+        out += indent + "while (y < " + std::to_string(depth * 10) + ") {\n";
+        out += indent + "    y = y + 1;\n";
+        Block(out, parameters, depth - 1, seed + 1, indent + "    ");
+        out += indent + "}\n";
+    }
+}
+
+static void Function(std::string& out, const Synthetic::Parameters& parameters, size_t index)
+{
+    out += "f" + std::to_string(index) + "(a, b) {\n";
+    out += "    auto x, y, s;\n";
+    out += "    y = b;\n";
+    for (size_t i = 0; i < parameters.strings; ++i) {
+        out += "    s = \"string " + std::to_string(index) + " number " + std::to_string(i) + "\";\n";
+    }
+    Block(out, parameters, parameters.depth, index, "    ");
+    if (index % 8 == 0) {
+        out += "    x = x + g" + std::to_string(index / 8) + "(x, y);\n";
+    }
+    out += "    return x - y;\n";
+    out += "}\n\n";
+}
+
+static void AsmFunction(std::string& out, const Synthetic::Parameters& parameters, size_t index)
+{
+    out += "g" + std::to_string(index) + " __asm__ {\n";
+    for (size_t i = 0; i < parameters.asmLines; ++i) {
+        out += "    \"";
+        out += ASM_LINES[(index + i) % 8];
+        out += "\"\n";
+    }
+    out += "}\n\n";
+}
+
+std::string Synthetic::Program(const Parameters& parameters)
+{
+    std::string out;
+    for (size_t i = 0; i < parameters.functions; ++i) {
+        if (i % 8 == 0) {
+            AsmFunction(out, parameters, i / 8);
+        }
+        Function(out, parameters, i);
+    }
+
+    // every function is reached from main, unused ones would never be compiled
+    out += "main() {\n";
+    out += "    auto total;\n";
+    out += "    total = 0;\n";
+    for (size_t i = 0; i < parameters.functions; ++i) {
+        out += "    total = total + f" + std::to_string(i) + "(" + std::to_string(i) + ", total);\n";
+    }
+    out += "    return total;\n";
+    out += "}\n";
+    return out;
+}
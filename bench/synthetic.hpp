@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+// Builds B programs of any size for the throughput benchmarks. Nothing is random, the same
+// parameters always give the same program, so results from different runs can be compared
+namespace Synthetic
+{
+    struct Parameters
+    {
+        size_t functions = 400;
+        size_t depth = 6;       // if/while nesting inside every function
+        size_t expression = 12; // terms in every long expression
+        size_t strings = 2;     // string literals per function
+        size_t asmLines = 48;   // lines in every __asm__ function, there is one for every 8 functions
+    };
+
+    std::string Program(const Parameters& parameters);
+}
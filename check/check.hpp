@@ -0,0 +1,8 @@
+#pragma once
+
+// Each check prints what went wrong to std::cerr and returns false at the first failure
+
+// compares IncrementalUnit against a full IRGenerator::Generate after every edit
+bool CheckIncremental();
+// compiles small programs at every -O level, runs them and compares what they print
+bool CheckCodegen();
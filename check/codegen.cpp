@@ -0,0 +1,353 @@
+#include "check/check.hpp"
+#include "src/compiler.hpp"
+#include "src/library.hpp"
+#include "src/file.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <sstream>
+#include <filesystem>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+// Compiles each program at every -O level, runs the URCL on a small interpreter and compares what it
+// prints with what the program is known to print, so a pass that miscompiles shows up as wrong output
+
+// Interpreter, just enough URCL for what the compiler and the standard library emit. Words are 16 bits,
+// the data section starts at address zero and the stack grows down from the top of the address space
+class Machine
+{
+public:
+    // false after printing why the program could not be loaded
+    bool Load(const std::string& program);
+    // false when the program fails or does not halt within `steps` instructions, `error` then says why
+    bool Run(size_t steps, std::string& output, std::string& error);
+
+private:
+    enum class Kind { REGISTER, IMMEDIATE, LABEL, RELATIVE, PORT };
+
+    struct Operand
+    {
+        Kind kind;
+        int32_t value;    // register number, immediate, instruction index or relative offset
+        std::string name; // label or port
+    };
+
+    struct Instruction
+    {
+        std::string opcode;
+        std::vector<Operand> ops;
+        size_t line;
+    };
+
+    static constexpr int32_t SP = 32;
+    static constexpr size_t MEMORY = 1 << 16;
+
+    std::vector<Instruction> m_instructions;
+    std::vector<uint16_t> m_data;
+    std::unordered_map<std::string, std::string> m_defines;
+    std::unordered_map<std::string, size_t> m_labels;
+
+    bool ParseOperand(std::string word, Operand& operand);
+    uint16_t Value(const Operand& operand, const uint16_t* registers) const;
+};
+
+bool Machine::ParseOperand(std::string word, Operand& operand)
+{
+    auto define = m_defines.find(word);
+    if (define != m_defines.end()) {
+        word = define->second;
+    }
+    if (word == "sp") {
+        operand = {Kind::REGISTER, SP, ""};
+    } else if ((word[0] == 'r' || word[0] == 'R' || word[0] == '$') && word.size() > 1 && isdigit((unsigned char)word[1])) {
+        operand = {Kind::REGISTER, std::stoi(word.substr(1)), ""};
+    } else if (word[0] == '.') {
+        operand = {Kind::LABEL, 0, word};
+    } else if (word[0] == '~') {
+        operand = {Kind::RELATIVE, std::stoi(word.substr(1)), ""};
+    } else if (word[0] == '%') {
+        operand = {Kind::PORT, 0, word.substr(1)};
+    } else if (isdigit((unsigned char)word[0]) || word[0] == '-' || word[0] == '+') {
+        operand = {Kind::IMMEDIATE, std::stoi(word), ""};
+    } else {
+        return false;
+    }
+    return !(operand.kind == Kind::REGISTER && operand.value > SP);
+}
+
+bool Machine::Load(const std::string& program)
+{
+    std::istringstream lines(program);
+    std::string text;
+    for (size_t line = 1; std::getline(lines, text); ++line) {
+        text = text.substr(0, text.find("//"));
+        std::istringstream words(text);
+        std::string opcode;
+        if (!(words >> opcode))
+            continue;
+        if (opcode[0] == '.') {
+            m_labels[opcode] = m_instructions.size();
+            continue;
+        }
+        for (auto& c: opcode) {
+            c = (char)tolower((unsigned char)c);
+        }
+
+        if (opcode == "bits" || opcode == "minstack" || opcode == "minheap" || opcode == "minreg" || opcode == "run")
+            continue;
+        if (opcode == "@define") {
+            std::string name, value;
+            words >> name >> value;
+            m_defines[name] = value;
+            continue;
+        }
+        if (opcode == "dw") {
+            std::string values;
+            std::getline(words, values);
+            for (auto& c: values) {
+                c = c == '[' || c == ']' || c == ',' ? ' ' : c;
+            }
+            std::istringstream numbers(values);
+            int32_t value;
+            while (numbers >> value) {
+                m_data.push_back((uint16_t)value);
+            }
+            continue;
+        }
+        Instruction instruction = {opcode, {}, line};
+        std::string word;
+        while (words >> word) {
+            Operand operand;
+            if (!ParseOperand(word, operand)) {
+                std::cerr << "[CHECK]: line " << line << ": cannot run operand '" << word << "'\n";
+                return false;
+            }
+            instruction.ops.push_back(std::move(operand));
+        }
+        m_instructions.push_back(std::move(instruction));
+    }
+
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        for (auto& operand: m_instructions[i].ops) {
+            if (operand.kind == Kind::RELATIVE) {
+                operand = {Kind::IMMEDIATE, (int32_t)i + operand.value, ""};
+            } else if (operand.kind == Kind::LABEL) {
+                auto label = m_labels.find(operand.name);
+                if (label == m_labels.end()) {
+                    std::cerr << "[CHECK]: line " << m_instructions[i].line << ": undefined label '" << operand.name << "'\n";
+                    return false;
+                }
+                operand = {Kind::IMMEDIATE, (int32_t)label->second, ""};
+            }
+        }
+    }
+    return true;
+}
+
+uint16_t Machine::Value(const Operand& operand, const uint16_t* registers) const
+{
+    return operand.kind == Kind::REGISTER ? registers[operand.value] : (uint16_t)operand.value;
+}
+
+bool Machine::Run(size_t steps, std::string& output, std::string& error)
+{
+    std::vector<uint16_t> memory(MEMORY, 0);
+    std::copy(m_data.begin(), m_data.end(), memory.begin());
+    uint16_t registers[SP + 1] = {};
+    size_t pc = 0;
+
+    for (size_t step = 0; step < steps; ++step) {
+        if (pc >= m_instructions.size()) {
+            error = "ran past the last instruction";
+            return false;
+        }
+        const Instruction& instruction = m_instructions[pc];
+        const std::string& op = instruction.opcode;
+        auto& ops = instruction.ops;
+        auto value = [&](size_t i) { return Value(ops[i], registers); };
+        auto set = [&](uint16_t result) {
+            if (ops[0].kind == Kind::REGISTER && ops[0].value != 0) {
+                registers[ops[0].value] = result;
+            }
+        };
+        auto push = [&](uint16_t word) {
+            registers[SP] -= 1;
+            memory[registers[SP]] = word;
+        };
+        auto pop = [&]() {
+            uint16_t word = memory[registers[SP]];
+            registers[SP] += 1;
+            return word;
+        };
+        size_t next = pc + 1;
+
+        if (op == "add") set(value(1) + value(2));
+        else if (op == "sub") set(value(1) - value(2));
+        else if (op == "mlt") set(value(1) * value(2));
+        else if (op == "div" || op == "mod") {
+            if (value(2) == 0) {
+                error = "division by zero";
+                return false;
+            }
+            set(op == "div" ? value(1) / value(2) : value(1) % value(2));
+        }
+        else if (op == "and") set(value(1) & value(2));
+        else if (op == "or") set(value(1) | value(2));
+        else if (op == "xor") set(value(1) ^ value(2));
+        else if (op == "not") set(~value(1));
+        else if (op == "inc") set(value(1) + 1);
+        else if (op == "dec") set(value(1) - 1);
+        else if (op == "setl") set(value(1) < value(2) ? 0xFFFF : 0);
+        else if (op == "setg") set(value(1) > value(2) ? 0xFFFF : 0);
+        else if (op == "setle") set(value(1) <= value(2) ? 0xFFFF : 0);
+        else if (op == "setge") set(value(1) >= value(2) ? 0xFFFF : 0);
+        else if (op == "sete") set(value(1) == value(2) ? 0xFFFF : 0);
+        else if (op == "setne") set(value(1) != value(2) ? 0xFFFF : 0);
+        else if (op == "brl") next = value(1) < value(2) ? value(0) : next;
+        else if (op == "brg") next = value(1) > value(2) ? value(0) : next;
+        else if (op == "ble") next = value(1) <= value(2) ? value(0) : next;
+        else if (op == "bge") next = value(1) >= value(2) ? value(0) : next;
+        else if (op == "bre") next = value(1) == value(2) ? value(0) : next;
+        else if (op == "bne") next = value(1) != value(2) ? value(0) : next;
+        else if (op == "brz") next = value(1) == 0 ? value(0) : next;
+        else if (op == "bnz") next = value(1) != 0 ? value(0) : next;
+        else if (op == "bev") next = value(1) % 2 == 0 ? value(0) : next;
+        else if (op == "bod") next = value(1) % 2 == 1 ? value(0) : next;
+        else if (op == "jmp") next = value(0);
+        else if (op == "imm" || op == "mov") set(value(1));
+        else if (op == "lod") set(memory[value(1)]);
+        else if (op == "str") memory[value(0)] = value(1);
+        else if (op == "llod") set(memory[(uint16_t)(value(1) + value(2))]);
+        else if (op == "lstr") memory[(uint16_t)(value(0) + value(1))] = value(2);
+        else if (op == "psh") push(value(0));
+        else if (op == "pop") set(pop());
+        else if (op == "cal") {
+            push((uint16_t)(pc + 1));
+            next = value(0);
+        }
+        else if (op == "ret") next = pop();
+        else if (op == "hlt") return true;
+        else if (op == "nop") {}
+        else if (op == "in") set(0);
+        else if (op == "out" && ops[0].name == "numb") output += std::to_string(value(1));
+        else if (op == "out" && ops[0].name == "int") output += std::to_string((int16_t)value(1));
+        else if (op == "out" && ops[0].name == "text") output += (char)value(1);
+        else {
+            error = "line " + std::to_string(instruction.line) + ": cannot run '" + op + "'";
+            return false;
+        }
+        pc = next;
+    }
+    error = "did not halt";
+    return false;
+}
+
+// Programs, each with what it prints. Every one is compiled at every level below
+struct Program
+{
+    const char* name;
+    const char* source;
+    const char* expected;
+};
+
+static const Program g_programs[] = {
+    // the value a call is nested in must survive the call
+    {"call inside an expression",
+        "g() { x = 7; return x * 3; }\n"
+        "main() { a = 5; putnumb(0 + (g() != a)); putline(); putnumb(2 * (g() - a)); putline(); }\n",
+        "65535\n32\n"},
+    {"recursion",
+        "fibonacci(n) { if (n < 2) return n; return fibonacci(n - 1) + fibonacci(n - 2); }\n"
+        "main() { i = 0; while (i < 10) { putnumb(fibonacci(i)); putchar(32); i = i + 1; } putline(); }\n",
+        "0 1 1 2 3 5 8 13 21 34 \n"},
+    {"arguments and locals",
+        "mix(a, b, c) { d = a * 100; e = b * 10; return d + e + c; }\n"
+        "main() { x = 1; y = 2; putnumb(mix(x, y, 3) - mix(0, 0, x + y)); putline(); }\n",
+        "120\n"},
+    {"comparisons and ternaries",
+        "pick(a, b) { return a < b ? a : b; }\n"
+        "main() { putnumb(pick(4, 9)); putchar(32); putnumb(pick(9, 4)); putchar(32);\n"
+        "    putnumb(3 == 3 ? 1 : 2); putchar(32); putnumb(3 != 3 ? 1 : 2); putline(); }\n",
+        "4 4 1 2\n"},
+    // conditions are tested as 16 bit words, constant ones included
+    {"constant conditions",
+        "main() { if (65536) putnumb(1); else putnumb(2); putline(); putnumb(65536 ? 3 : 4); putline();\n"
+        "    while (131072) { putnumb(5); } putnumb(6); putline(); }\n",
+        "2\n4\n6\n"},
+    {"strings and pointers",
+        "main() { s = \"hi\"; puts(s); putnumb(*s); putline(); }\n",
+        "hi\n104\n"},
+    {"function pointers",
+        "twice(n) { return n * 2; }\n"
+        "apply(f, n) { return f(f(n)); }\n"
+        "main() { putnumb(apply(twice, 5)); putline(); }\n",
+        "20\n"},
+};
+
+struct Level
+{
+    const char* flags;
+    PassManager::Level level;
+    const char* disabled;
+};
+
+static const Level g_levels[] = {
+    {"-O0", PassManager::Level::O0, nullptr},
+    {"-O1", PassManager::Level::O1, nullptr},
+    {"-O2", PassManager::Level::O2, nullptr},
+    {"-Os", PassManager::Level::OS, nullptr},
+    {"-O2 -fno-tree-select", PassManager::Level::O2, "tree-select"},
+};
+
+static bool CompileProgram(Library& library, const Program& program, const Level& level, const std::string& outputPath)
+{
+    IRGenerator irGen;
+    irGen.SetSourceName(program.name);
+    std::vector<IRInfo> toLink;
+    toLink.push_back(irGen.Generate(program.source));
+    if (irGen.PrintErrors() || !library.LoadReferenced(toLink))
+        return false;
+
+    PassManager passes;
+    passes.SetLevel(level.level);
+    if (level.disabled) {
+        passes.Disable(level.disabled);
+    }
+    Compiler compiler;
+    compiler.SetPasses(passes);
+    compiler.LinkAndCompile(std::move(toLink), outputPath);
+    return !compiler.HasErrors();
+}
+
+bool CheckCodegen()
+{
+    Library library("lib", "lib/.cache");
+    if (!library.Scan())
+        return false;
+    std::string outputPath = (fs::temp_directory_path() / "bcc-check.urcl").string();
+
+    bool passed = true;
+    for (auto& program: g_programs) {
+        for (auto& level: g_levels) {
+            std::string what = "'" + std::string(program.name) + "' at " + level.flags;
+            std::string urcl, output, error;
+            Machine machine;
+            if (!CompileProgram(library, program, level, outputPath) || !File::ReadEverything(outputPath, urcl)) {
+                std::cerr << "[CHECK]: could not compile " << what << '\n';
+                passed = false;
+            } else if (!machine.Load(urcl) || !machine.Run(1 << 20, output, error) || output != program.expected) {
+                std::cerr << "[CHECK]: " << what << (error.empty() ? " printed the wrong output" : " " + error) << "\n--- source\n"
+                          << program.source << "--- expected\n" << program.expected << "--- actual\n" << output << "\n--- urcl" << urcl;
+                passed = false;
+            }
+            if (!passed)
+                break;
+        }
+        if (!passed)
+            break;
+    }
+    std::remove(outputPath.c_str());
+    return passed;
+}
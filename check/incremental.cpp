@@ -0,0 +1,152 @@
+#include "check/check.hpp"
+#include "bench/synthetic.hpp"
+#include "src/incremental.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+// Compares IncrementalUnit against a full IRGenerator::Generate after every edit, line numbers
+// and diagnostics included, stopping at the first edit where the two disagree
+
+static void Describe(std::ostream& out, const IRInfo& irInfo, const std::string& errors)
+{
+    auto set = [&](const char* name, const SymbolSet& symbols) {
+        out << name << ':';
+        for (Symbol symbol: symbols) {
+            out << ' ' << Symbols::Name(symbol);
+        }
+        out << '\n';
+    };
+    set("globals", irInfo.globals);
+    set("references", irInfo.references);
+    set("strings", irInfo.strings);
+    for (Symbol global: irInfo.globals) {
+        auto found = irInfo.globalsMap.find(global);
+        if (found == irInfo.globalsMap.end()) {
+            out << "missing " << Symbols::Name(global) << '\n';
+            continue;
+        }
+        const IRValues& irValues = found->second.irValues;
+        out << Symbols::Name(global) << " type " << (int)irValues.type << " line " << irValues.line << '\n';
+        set("  references", found->second.references);
+        for (auto& value: irValues.values) {
+            out << "  " << (int)value.type << ' ' << value.operand << ' ' << Symbols::Name(value.symbol) << '\n';
+        }
+        for (auto& block: irValues.assembly) {
+            for (auto& line: block) {
+                out << "  asm " << line << '\n';
+            }
+        }
+        for (auto& line: irValues.lines) {
+            out << "  at " << line.first << ' ' << line.second << '\n';
+        }
+    }
+    // entries only a redefinition or a stale item could leave behind
+    std::vector<std::string> strays;
+    for (auto& entry: irInfo.globalsMap) {
+        if (!irInfo.globals.count(entry.first)) {
+            strays.push_back(Symbols::Name(entry.first));
+        }
+    }
+    std::sort(strays.begin(), strays.end());
+    for (auto& stray: strays) {
+        out << "stray " << stray << '\n';
+    }
+    out << errors;
+}
+
+static std::string FirstLine(const std::string& text)
+{
+    return text.substr(0, text.find('\n') + 1);
+}
+
+static bool Same(const std::string& expected, const std::string& actual, const std::string& what, const std::string& source)
+{
+    if (expected == actual)
+        return true;
+    std::cerr << "[CHECK]: " << what << "\n--- source\n" << source << "\n--- expected\n" << expected << "--- actual\n" << actual;
+    return false;
+}
+
+// Items are generated on their own, so once the file has errors only the first diagnostic is bound
+// to agree, recovery may then resume at other tokens than it does in one pass over the whole file
+static bool Matches(const IncrementalUnit& unit, const std::string& step)
+{
+    IRGenerator irGen;
+    irGen.SetSourceName("check.b");
+    IRInfo full = irGen.Generate(unit.Source());
+    std::string fullErrors = irGen.ErrorText();
+    if (!fullErrors.empty())
+        return Same(FirstLine(fullErrors), FirstLine(unit.Errors()), "first diagnostic differs from a full generate after " + step, unit.Source());
+
+    std::ostringstream expected, actual;
+    Describe(expected, full, fullErrors);
+    Describe(actual, unit.GetIRInfo(), unit.Errors());
+    return Same(expected.str(), actual.str(), "result differs from a full generate after " + step, unit.Source());
+}
+
+static bool Edit(IncrementalUnit& unit, size_t offset, size_t removed, const std::string& inserted, const std::string& step)
+{
+    unit.Edit(offset, removed, inserted);
+    return Matches(unit, step);
+}
+
+// Edits that once went wrong, kept so they stay fixed
+static bool CheckKnownEdits()
+{
+    IncrementalUnit unit;
+    unit.SetSourceName("check.b");
+    unit.Open("a() {\n    return 1;\n}\nb() {\n    return 2;\n}\nc() {\n    return 3;\n}\n");
+    if (!Matches(unit, "open"))
+        return false;
+    // a comment opened at the top swallows every item, closing it before c brings c back at line 7
+    if (!Edit(unit, 0, 0, "/*", "opening a comment"))
+        return false;
+    return Edit(unit, unit.Source().find("c()"), 0, "*/", "closing it before c");
+}
+
+// Random edits over a small synthetic program, most of them undone again so it stays mostly valid
+static bool CheckRandomEdits(size_t edits)
+{
+    static const std::string SNIPPETS[] = {
+        "/*", "*/", "\"", "\n", "\n\n", "{", "}", "(", ")", ";", "x", " + 1", "return 2;\n",
+        "h() {\n    return 3;\n}\n", "g0(x, y);\n", "f1 = 5;\n", "__asm__ {\n    mov r1 r2\n}\n",
+    };
+    Synthetic::Parameters parameters;
+    parameters.functions = 12;
+    parameters.depth = 2;
+    parameters.expression = 3;
+    parameters.asmLines = 3;
+    std::string original = Synthetic::Program(parameters);
+
+    IncrementalUnit unit;
+    unit.SetSourceName("check.b");
+    unit.Open(original);
+    if (!Matches(unit, "open"))
+        return false;
+
+    std::mt19937 random(20);
+    for (size_t i = 0; i < edits; ++i) {
+        const std::string& source = unit.Source();
+        if (random() % 8 == 0) {
+            if (!Edit(unit, 0, source.size(), original, "edit " + std::to_string(i) + ", restoring the program"))
+                return false;
+            continue;
+        }
+        size_t offset = random() % (source.size() + 1);
+        size_t removed = random() % 3 == 0 ? random() % 16 : 0;
+        const std::string& inserted = random() % 4 == 0 ? std::string() : SNIPPETS[random() % std::size(SNIPPETS)];
+        std::string step = "edit " + std::to_string(i) + " at " + std::to_string(offset) + " removing " +
+                           std::to_string(removed) + " inserting '" + inserted + "'";
+        if (!Edit(unit, offset, removed, inserted, step))
+            return false;
+    }
+    return true;
+}
+
+bool CheckIncremental()
+{
+    return CheckKnownEdits() && CheckRandomEdits(2000);
+}
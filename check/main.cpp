@@ -0,0 +1,14 @@
+#include "check/check.hpp"
+
+#include <iostream>
+
+int main()
+{
+    if (!CheckIncremental())
+        return 1;
+    std::cout << "[CHECK]: incremental reparsing matches a full generate\n";
+    if (!CheckCodegen())
+        return 1;
+    std::cout << "[CHECK]: compiled programs print the same at every level\n";
+    return 0;
+}
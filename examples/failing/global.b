@@ -0,0 +1,6 @@
+/* global variables are not supported yet, make -f Examples.mk check expects this one to fail */
+x = 5;
+
+main() {
+    putnumb(x);
+}
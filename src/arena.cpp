@@ -0,0 +1,79 @@
+#include "arena.hpp"
+
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+Arena::Arena(size_t blockSize)
+{
+    m_blockSize = blockSize;
+    m_current = 0;
+    m_cursor = nullptr;
+    m_end = nullptr;
+}
+
+Arena::~Arena()
+{
+    for (auto& block: m_blocks) {
+        std::free(block.data);
+    }
+}
+
+static char* AlignUp(char* pointer, size_t alignment)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+    return reinterpret_cast<char*>((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+bool Arena::NextBlock(size_t size, size_t alignment)
+{
+    // reuse blocks kept from before the last reset, skipping any that are too small
+    size_t next = m_cursor ? m_current + 1 : m_current;
+    for (; next < m_blocks.size(); ++next) {
+        if (m_blocks[next].size >= size + alignment)
+            break;
+    }
+
+    if (next >= m_blocks.size()) {
+        size_t blockSize = std::max(m_blockSize, size + alignment);
+        char* data = static_cast<char*>(std::malloc(blockSize));
+        if (!data)
+            return false;
+        m_blocks.push_back({data, blockSize});
+        next = m_blocks.size() - 1;
+    }
+
+    m_current = next;
+    m_cursor = m_blocks[next].data;
+    m_end = m_cursor + m_blocks[next].size;
+    return true;
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+    char* start = m_cursor ? AlignUp(m_cursor, alignment) : nullptr;
+    if (!start || start + size > m_end) {
+        if (!NextBlock(size, alignment))
+            throw std::bad_alloc();
+        start = AlignUp(m_cursor, alignment);
+    }
+    m_cursor = start + size;
+    return start;
+}
+
+void Arena::Reset()
+{
+    m_current = 0;
+    m_cursor = nullptr;
+    m_end = nullptr;
+}
+
+size_t Arena::BytesReserved() const
+{
+    size_t total = 0;
+    for (auto& block: m_blocks) {
+        total += block.size;
+    }
+    return total;
+}
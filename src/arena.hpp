@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+// Bump allocator, everything allocated from it is released at once by Reset or the destructor
+class Arena
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+    // keeps the blocks around so the next phase allocates without touching malloc
+    void Reset();
+    size_t BytesReserved() const;
+
+    template<typename T>
+    T* Allocate(size_t count)
+    {
+        return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+    }
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    // Arena Info
+    std::vector<Block> m_blocks;
+    size_t m_blockSize;
+    size_t m_current;
+    char* m_cursor;
+    char* m_end;
+
+    bool NextBlock(size_t size, size_t alignment);
+};
+
+// Lets standard containers allocate from an arena, deallocation is a no-op until the arena resets
+template<typename T>
+struct ArenaAllocator
+{
+    using value_type = T;
+    // moved containers keep their arena instead of copying into the destination's
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    Arena* arena;
+
+    ArenaAllocator(Arena* arena) : arena(arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return arena->Allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
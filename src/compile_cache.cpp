@@ -0,0 +1,104 @@
+#include "compile_cache.hpp"
+#include "serializer.hpp"
+#include "file.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Bump whenever the output for the same inputs changes, the build stamp covers local rebuilds
+static constexpr uint64_t COMPILE_CACHE_VERSION = 1;
+static constexpr const char* BUILD_STAMP = __DATE__ " " __TIME__;
+
+CompileCache::CompileCache(const std::string& directory)
+{
+    m_directory = directory;
+    m_key = "bcc " + std::to_string(COMPILE_CACHE_VERSION) + " " + BUILD_STAMP + "\n";
+}
+
+void CompileCache::AddFlag(std::string_view flag)
+{
+    m_key += "flag ";
+    m_key += flag;
+    m_key += '\n';
+}
+
+bool CompileCache::AddFile(const std::string& path)
+{
+    std::error_code error;
+    if (!fs::is_regular_file(path, error))
+        return false;
+
+    File::Mapping file;
+    if (!file.Open(path))
+        return false;
+    std::string_view contents = file.View();
+
+    char line[64];
+    snprintf(line, sizeof(line), "file %016llx %zu\n", (unsigned long long)Serializer::Hash(contents), contents.size());
+    m_key += line;
+    return true;
+}
+
+std::string CompileCache::EntryPath(const char* extension) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)Serializer::Hash(m_key), extension);
+    return (fs::path(m_directory) / name).string();
+}
+
+bool CompileCache::Fetch(const std::string& outputPath) const
+{
+    // the whole key is stored next to the entry, so a hash collision is a miss and not a wrong program
+    std::ifstream keyFile(EntryPath(".key"), std::ios::binary);
+    if (!keyFile)
+        return false;
+    std::stringstream stored;
+    stored << keyFile.rdbuf();
+    if (stored.str() != m_key)
+        return false;
+
+    std::error_code error;
+    fs::copy_file(EntryPath(".urcl"), outputPath, fs::copy_options::overwrite_existing, error);
+    return !error;
+}
+
+void CompileCache::Store(const std::string& outputPath) const
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error)
+        return;
+
+    // write to unique temporaries first so concurrent compilers never see a partial entry
+    std::string suffix = "." + std::to_string(std::random_device{}()) + ".tmp";
+    std::string entry = EntryPath(".urcl");
+    std::string key = EntryPath(".key");
+
+    fs::copy_file(outputPath, entry + suffix, fs::copy_options::overwrite_existing, error);
+    if (!error) {
+        fs::rename(entry + suffix, entry, error);
+    }
+    if (error) {
+        fs::remove(entry + suffix, error);
+        return;
+    }
+
+    {
+        std::ofstream file(key + suffix, std::ios::binary);
+        file << m_key;
+        if (!file) {
+            file.close();
+            fs::remove(key + suffix, error);
+            return;
+        }
+    }
+    fs::rename(key + suffix, key, error);
+    if (error) {
+        fs::remove(key + suffix, error);
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Opt-in cache of finished .urcl outputs. The key covers every input file, the library sources,
+// the flags that change the output and the compiler build, a hit copies the stored output back
+class CompileCache
+{
+public:
+    static constexpr const char* DEFAULT_DIRECTORY = ".bcc-cache";
+
+    explicit CompileCache(const std::string& directory);
+
+    void AddFlag(std::string_view flag);
+    bool AddFile(const std::string& path);
+    bool Fetch(const std::string& outputPath) const;
+    void Store(const std::string& outputPath) const;
+
+private:
+    // Cache Info
+    std::string m_directory;
+    std::string m_key;
+
+    std::string EntryPath(const char* extension) const;
+};
@@ -1,44 +1,52 @@
 
 #include "compiler.hpp"
-#include "urcl_optimizer.hpp"
+#include "thread_pool.hpp"
+#include "ir_passes.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstdio>
 
 
-std::string Compiler::MakeLabel()
-{
-    return ".L" + std::to_string(m_labels++) + "_";
-}
-
 void Compiler::ResolveSymbols()
 {
-    std::unordered_set<std::string> globals;
-    m_references = {"main"};
-
+    m_symbols.clear();
+    m_references = {Symbols::Intern("main")};
 
+    // Symbol Table, every global name to its definition
     for (auto& irInfo: m_irInfoList) {
         for (const auto& global: irInfo.globals) {
-            auto result = globals.insert(global);
+            auto result = m_symbols.emplace(global, &irInfo.globalsMap[global]);
             if (!result.second) {
-                std::cerr << "[LINKER ERROR]: multiple definitions of symbol: '" << global << "'\n";
+                std::cerr << "[LINKER ERROR]: multiple definitions of symbol: '" << Symbols::Name(global) << "'\n";
                 m_gotError = true;
             }
         }
         m_references.insert(irInfo.references.begin(), irInfo.references.end());
     }
 
-    for (const auto& symbol: m_references) {
-        if (!globals.count(symbol)) {
-            std::cerr << "[LINKER ERROR]: undefined symbol: '" << symbol << "'\n";
-            m_gotError = true;
+    // reported in source order
+    SymbolSet undefined;
+    if (!m_symbols.count(Symbols::Intern("main"))) {
+        undefined.insert(Symbols::Intern("main"));
+    }
+    for (auto& irInfo: m_irInfoList) {
+        for (Symbol symbol: irInfo.references) {
+            if (!m_symbols.count(symbol)) {
+                undefined.insert(symbol);
+            }
         }
     }
+    for (Symbol symbol: undefined) {
+        std::cerr << "[LINKER ERROR]: undefined symbol: '" << Symbols::Name(symbol) << "'\n";
+        m_gotError = true;
+    }
 
     // Dead Code Elimination
     for (auto& irInfo: m_irInfoList) {
         for (const auto& global: irInfo.globals) {
-            auto& references = irInfo.globalsMap[global].references;
+            auto& references = m_symbols[global]->references;
             
             // if global is not inside references, erase every symbol that the global needs
             // else, insert them again if needed
@@ -55,306 +63,597 @@ void Compiler::ResolveSymbols()
         }
     }
 }
+// Emitter Functions
+static const Operand R1 = Operand::Register(1);
+static const Operand R2 = Operand::Register(2);
+
+static Operand BP()
+{
+    static const Operand bp = Operand::Named(Symbols::Intern("bp"));
+    return bp;
+}
 
-void Compiler::Emit(const std::string& basic) 
+static Operand SP()
 {
-    m_output << "    " << basic << '\n';
+    static const Operand sp = Operand::Named(Symbols::Intern("sp"));
+    return sp;
 }
 
-void Compiler::EmitBasic(const std::string& basic)
+void FunctionCompiler::Emit(Opcode opcode, Operand a, Operand b, Operand c)
 {
-    m_output << basic << '\n';
+    m_program.Emit(opcode, a, b, c);
 }
 
+void FunctionCompiler::EmitLabel(uint32_t label)
+{
+    m_program.PlaceLabel(label);
+}
+
+
 void Compiler::CompileStrings()
 {
-    std::unordered_set<std::string> strings;
+    // laid out in source order so the data section does not depend on interning order
+    SymbolSet strings;
 
     for (auto& irInfo: m_irInfoList) {
-        for (auto& string: irInfo.strings) {
+        for (Symbol string: irInfo.strings) {
             strings.insert(string);
         }
     }
-    for (auto& string: strings) {
-        m_data << "    dw [";
+    for (Symbol symbol: strings) {
+        const std::string& string = Symbols::Name(symbol);
+        *m_output << "    dw [";
         for (unsigned char c: string) {
-            m_data << (int)c << ",";
+            *m_output << (int64_t)c << ',';
         }
-        m_data << 0;
-        m_data << ']' << '\n';
-        m_strings[string] = std::to_string(m_heapBase);
+        *m_output << "0]\n";
+        m_strings[symbol] = m_heapBase;
         // include '\0'
         m_heapBase += string.size() + 1;
     }
 }
 
-IRValues Compiler::GetGlobalValues(const std::string& name)
+const IRValues* Compiler::GetGlobalValues(Symbol name) const
 {
-    for (auto& irInfo: m_irInfoList) {
-        if (irInfo.globalsMap.find(name) != irInfo.globalsMap.end()) {
-            return irInfo.globalsMap[name].irValues;
-        }
-    }
-    return (IRValues){};
+    auto found = m_symbols.find(name);
+    if (found == m_symbols.end())
+        return nullptr;
+    return &found->second->irValues;
 }
 
-// Reserved for Compiler::CompileValues()
-#define FetchOpcode() std::get<IR_TYPE>(values[i++])
-#define FetchString() std::get<IR_STRING>(values[i++])
-#define FetchStringList() std::get<IR_STRINGLIST>(values[i++])
+// Instructions the tree selector sees through, anything else finds every value on the real stack
+static bool KeepsTrees(IRType type)
+{
+    switch (type) {
+        case IRType::LOAD_NUMBER:
+        case IRType::LOAD_STRING:
+        case IRType::LOAD_FROMBASE:
+        case IRType::REF_FROMBASE:
+        case IRType::LOAD_GLOBAL:
+        case IRType::LOAD_RETURNED:
+        case IRType::DEREF:
+        case IRType::NOT:
+        case IRType::ADD:
+        case IRType::SUB:
+        case IRType::MUL:
+        case IRType::DIV:
+        case IRType::MOD:
+        case IRType::EQUAL:
+        case IRType::NEQUAL:
+        case IRType::GREATER:
+        case IRType::LESS:
+        case IRType::GE:
+        case IRType::LE:
+        case IRType::ASSIGN_FROMBASE:
+        case IRType::ASSIGN_MEMORY:
+        case IRType::RETURN_VALUE:
+        case IRType::BEGIN_IF:
+        case IRType::BEGIN_TERNARY:
+        case IRType::END_WHILE_COND:
+            return true;
+        default:
+            return false;
+    }
+}
 
-void Compiler::CompileValues(const std::vector<IRValue>& values)
+void FunctionCompiler::CompileValues(const IRValues& irValues)
 {
     size_t i = 0;
-    std::string tmp, tmp2;
+    uint32_t label, label2;
+    auto& values = irValues.values;
     size_t irSize = values.size();
+    size_t line = 0;
+    uint32_t sourceLine = irValues.line;
     
     while (i < irSize) {
-        auto& op = FetchOpcode();
+        while (line < irValues.lines.size() && irValues.lines[line].first <= i) {
+            sourceLine = irValues.lines[line++].second;
+            m_program.SetLine(sourceLine);
+        }
+        const IRInstruction& instruction = values[i++];
+        IRType op = instruction.type;
+        Operand operand = Operand::Immediate(instruction.operand);
+        if (m_trees && !KeepsTrees(op)) {
+            m_selector.Flush();
+        }
 
         switch (op) {
             case IRType::INLINE_ASM: {
-                auto& list = FetchStringList();
-                for (auto str: list) {
-                    Emit(str);
-                }
+                m_program.EmitAssembly(irValues.assembly[instruction.operand]);
                 break;
             }
             case IRType::LOAD_NUMBER:
-                tmp = FetchString();
-                Emit("psh "+tmp);
+                if (m_trees) {
+                    m_selector.PushValue(operand);
+                    break;
+                }
+                Emit(Opcode::PSH, operand);
                 break;
             case IRType::LOAD_STRING:
-                tmp = FetchString();
-                Emit("psh "+m_strings[tmp]);
+                operand = Operand::Immediate(m_compiler.m_strings.at(instruction.symbol));
+                if (m_trees) {
+                    m_selector.PushValue(operand);
+                    break;
+                }
+                Emit(Opcode::PSH, operand);
                 break;
             case IRType::LOAD_FROMBASE:
-                tmp = FetchString();
-                Emit("llod r1 bp "+tmp);
-                Emit("psh r1");
+                if (m_trees) {
+                    m_selector.PushLocal(instruction.operand);
+                    break;
+                }
+                Emit(Opcode::LLOD, R1, BP(), operand);
+                Emit(Opcode::PSH, R1);
                 break;
             case IRType::ASSIGN_FROMBASE:
-                tmp = FetchString();
-                Emit("pop r1");
-                Emit("lstr bp "+tmp+" r1");
+                if (m_trees) {
+                    m_selector.StoreLocal(instruction.operand);
+                    break;
+                }
+                Emit(Opcode::POP, R1);
+                Emit(Opcode::LSTR, BP(), operand, R1);
                 break;
             case IRType::ASSIGN_MEMORY:
-                Emit("pop r1");
-                Emit("pop r2");
-                Emit("str r2 r1");
+                if (m_trees) {
+                    m_selector.StoreMemory();
+                    break;
+                }
+                Emit(Opcode::POP, R1);
+                Emit(Opcode::POP, R2);
+                Emit(Opcode::STR, R2, R1);
                 break;
             case IRType::REF_FROMBASE:
-                tmp = FetchString();
-                Emit("add r1 bp "+tmp);
-                Emit("psh r1");
+                if (m_trees) {
+                    m_selector.PushAddress(instruction.operand);
+                    break;
+                }
+                Emit(Opcode::ADD, R1, BP(), operand);
+                Emit(Opcode::PSH, R1);
                 break;
             case IRType::LOAD_GLOBAL: {
-                tmp = FetchString();
-                auto global = GetGlobalValues(tmp);
-                if (global.type == IRValuesType::FUNCTION || global.type == IRValuesType::ASM_FUNCTION) {
-                    Emit("psh ."+tmp);
+                Symbol name = instruction.symbol;
+                auto global = m_compiler.GetGlobalValues(name);
+                if (!global || global->type == IRValuesType::FUNCTION || global->type == IRValuesType::ASM_FUNCTION) {
+                    operand = Operand::Label(m_program.NamedLabel(name));
+                    if (m_trees) {
+                        m_selector.PushValue(operand);
+                    } else {
+                        Emit(Opcode::PSH, operand);
+                    }
                 } else {
-                    std::cerr << "unsupported global type: " << (int)global.type << '\n';
-                    exit(1);
+                    Error(sourceLine, "global variables are not supported yet: '" + Symbols::Name(name) + "'");
+                    return;
                 }
                 break;
             }
             case IRType::CALL: 
-                tmp = FetchString();
-                tmp2 = std::to_string(std::stoull(tmp) + 1);
-                Emit("llod r1 sp "+tmp);
-                Emit("cal r1");
-                Emit("add sp sp "+tmp2);
+                Emit(Opcode::LLOD, R1, SP(), operand);
+                Emit(Opcode::CAL, R1);
+                Emit(Opcode::ADD, SP(), SP(), Operand::Immediate(instruction.operand + 1));
+                if (m_trees) {
+                    m_selector.Drop(instruction.operand + 1);
+                }
                 break;
             case IRType::CALL_FUNCTION: 
-                tmp = FetchString();
-                tmp2 = FetchString();
-                Emit("cal ."+tmp);
-                if (tmp2 != "0") {
-                    Emit("add sp sp "+tmp2);
+                Emit(Opcode::CAL, Operand::Label(m_program.NamedLabel(instruction.symbol)));
+                if (instruction.operand != 0) {
+                    Emit(Opcode::ADD, SP(), SP(), operand);
+                }
+                if (m_trees) {
+                    m_selector.Drop(instruction.operand);
                 }
                 break;
             case IRType::LOAD_RETURNED:
-                Emit("psh r1");
+                if (m_trees) {
+                    m_selector.PushReturned();
+                    break;
+                }
+                Emit(Opcode::PSH, R1);
                 break;
             case IRType::RETURN: {
                 bool isLast = (i >= irSize);
                 if (!isLast) {
-                    Emit("jmp " + GetLeave());
+                    Emit(Opcode::JMP, Operand::Label(GetLeave()));
                 }
                 break;
             }
             case IRType::RETURN_VALUE: {
-                Emit("pop r1");
+                if (m_trees) {
+                    m_selector.PopInto(R1);
+                } else {
+                    Emit(Opcode::POP, R1);
+                }
                 bool isLast = (i >= irSize);
                 if (!isLast) {
-                    Emit("jmp " + GetLeave());
+                    Emit(Opcode::JMP, Operand::Label(GetLeave()));
                 }
                 break;
             }
             case IRType::DEREF:
-                Emit("pop r1");
-                Emit("lod r1 r1");
-                Emit("psh r1");
+                if (m_trees) {
+                    m_selector.Deref();
+                    break;
+                }
+                Emit(Opcode::POP, R1);
+                Emit(Opcode::LOD, R1, R1);
+                Emit(Opcode::PSH, R1);
                 break;
             case IRType::BEGIN_TERNARY:
-                tmp = MakeLabel(); // false
-                tmp2 = MakeLabel(); // true
-                m_ternaryStack.push_back(tmp2);
-                m_ternaryStack.push_back(tmp);
-                Emit("pop r1");
-                Emit("brz "+tmp+" r1");
+                label = MakeLabel(); // false
+                label2 = MakeLabel(); // true
+                m_ternaryStack.push_back(label2);
+                m_ternaryStack.push_back(label);
+                BranchIfFalse(label);
                 break;
             case IRType::GOTO_TERNARYEND:
-                tmp = m_ternaryStack[m_ternaryStack.size()-2];
-                Emit("jmp "+tmp);
+                label = m_ternaryStack[m_ternaryStack.size()-2];
+                Emit(Opcode::JMP, Operand::Label(label));
+                if (m_trees) {
+                    // the false arm starts without the true arm's value
+                    m_selector.Drop(1);
+                }
                 break;
             case IRType::TERNARY_FALSE:
-                tmp = m_ternaryStack.back();
+                label = m_ternaryStack.back();
                 m_ternaryStack.pop_back();
-                EmitBasic(tmp);
+                EmitLabel(label);
                 break;
             case IRType::END_TERNARY:
-                tmp = m_ternaryStack.back();
+                label = m_ternaryStack.back();
                 m_ternaryStack.pop_back();
-                EmitBasic(tmp);
+                EmitLabel(label);
                 break;        
             case IRType::BEGIN_IF:
-                tmp = MakeLabel();
-                Emit("pop r1");
-                Emit("brz "+tmp+" r1");
-                m_ifStack.push_back(tmp);
+                label = MakeLabel();
+                BranchIfFalse(label);
+                m_ifStack.push_back(label);
                 break;
             case IRType::ADD_ELSE:
-                tmp = m_ifStack.back();
-                tmp2 = MakeLabel();
+                label = m_ifStack.back();
+                label2 = MakeLabel();
                 m_ifStack.pop_back();
-                Emit("jmp "+tmp2);
-                EmitBasic(tmp);        
-                m_ifStack.push_back(tmp2);
+                Emit(Opcode::JMP, Operand::Label(label2));
+                EmitLabel(label);        
+                m_ifStack.push_back(label2);
                 break;
             case IRType::END_IF:
-                tmp = m_ifStack.back();
+                label = m_ifStack.back();
                 m_ifStack.pop_back();
-                EmitBasic(tmp);
+                EmitLabel(label);
                 break;
             case IRType::RESERVE_STACK:
-                tmp = FetchString();
-                Emit("sub sp sp "+tmp);
+                Emit(Opcode::SUB, SP(), SP(), operand);
                 break;
             case IRType::PUT_LABEL:
-                tmp = FetchString();
-                Emit("."+tmp);
+                label = m_program.NamedLabel(instruction.symbol);
+                EmitLabel(label);
+                m_program.ExportLabel(label);
                 break;
             case IRType::GOTO_LABEL:
-                tmp = FetchString();
-                Emit("jmp ."+tmp);
+                Emit(Opcode::JMP, Operand::Label(m_program.NamedLabel(instruction.symbol)));
                 break;
             case IRType::BEGIN_WHILE:
-                tmp = MakeLabel(); // begin
-                EmitBasic(tmp);
-                m_whileStack.push_back(tmp);
+                label = MakeLabel(); // begin
+                EmitLabel(label);
+                m_whileStack.push_back(label);
                 break;
             case IRType::END_WHILE_COND:
-                tmp = MakeLabel(); // end
-                Emit("pop r1");
-                Emit("brz "+tmp+" r1");
-                m_whileStack.push_back(tmp);
+                label = MakeLabel(); // end
+                BranchIfFalse(label);
+                m_whileStack.push_back(label);
                 break;
             case IRType::END_WHILE:
-                tmp = m_whileStack.back(); // end
+                label = m_whileStack.back(); // end
                 m_whileStack.pop_back();
-                tmp2 = m_whileStack.back(); // begin
+                label2 = m_whileStack.back(); // begin
                 m_whileStack.pop_back();
-                Emit("jmp "+tmp2);
-                EmitBasic(tmp);
+                Emit(Opcode::JMP, Operand::Label(label2));
+                EmitLabel(label);
                 break;
             case IRType::EQUAL:
-                MakeBinop("sete");
+                MakeBinop(Opcode::SETE);
                 break;
             case IRType::NEQUAL:
-                MakeBinop("setne");
+                MakeBinop(Opcode::SETNE);
                 break;
             case IRType::GREATER:
-                MakeBinop("setg");
+                MakeBinop(Opcode::SETG);
                 break;
             case IRType::LESS:
-                MakeBinop("setl");
+                MakeBinop(Opcode::SETL);
                 break;
             case IRType::GE:
-                MakeBinop("setge");
+                MakeBinop(Opcode::SETGE);
                 break;
             case IRType::LE:
-                MakeBinop("setle");
+                MakeBinop(Opcode::SETLE);
                 break;
             case IRType::NOT:
-                Emit("pop r1");
-                Emit("not r1 r1");
-                Emit("psh r1");
+                if (m_trees) {
+                    m_selector.Not();
+                    break;
+                }
+                Emit(Opcode::POP, R1);
+                Emit(Opcode::NOT, R1, R1);
+                Emit(Opcode::PSH, R1);
                 break;
             case IRType::ADD:
-                MakeBinop("add");
+                MakeBinop(Opcode::ADD);
                 break;
             case IRType::SUB:
-                MakeBinop("sub");
+                MakeBinop(Opcode::SUB);
                 break;
             case IRType::MUL:
-                MakeBinop("mlt");
+                MakeBinop(Opcode::MLT);
                 break;
             case IRType::DIV:
-                MakeBinop("div");
+                MakeBinop(Opcode::DIV);
                 break;
             case IRType::MOD:
-                MakeBinop("mod");
+                MakeBinop(Opcode::MOD);
                 break;
             default:
-                std::cerr << "unsupported opcode: " << (int)op << '\n';
-                exit(1);
+                Error(sourceLine, "unsupported IR opcode: " + std::to_string((int)op));
+                return;
         }
     }
 }
 
-void Compiler::MakeBinop(const std::string& op)
+// Errors print like the generator's, the function is left unfinished and never written out
+void FunctionCompiler::Error(uint32_t line, const std::string& message)
+{
+    m_errors += "[COMPILE ERROR]: " + *m_sourceName + ':' + std::to_string(line) + ": " + Symbols::Name(m_name) + ": " + message + '\n';
+}
+
+void FunctionCompiler::MakeBinop(Opcode op)
+{
+    if (m_trees) {
+        m_selector.Apply(op);
+        return;
+    }
+    Emit(Opcode::POP, R1);
+    Emit(Opcode::POP, R2);
+    Emit(op, R1, R2, R1);
+    Emit(Opcode::PSH, R1);
+}
+
+void FunctionCompiler::BranchIfFalse(uint32_t label)
+{
+    if (m_trees) {
+        m_selector.BranchIfFalse(label);
+        return;
+    }
+    Emit(Opcode::POP, R1);
+    Emit(Opcode::BRZ, Operand::Label(label), R1);
+}
+
+uint32_t FunctionCompiler::MakeLabel()
 {
-    Emit("pop r1");
-    Emit("pop r2");
-    Emit(op+" r1 r2 r1");
-    Emit("psh r1");
+    return m_program.NewLabel();
 }
 
-void Compiler::CompileFunction(const std::string& name, const std::vector<IRValue>& values) 
+void FunctionCompiler::CompileFunction(Symbol name, const IRValues& values) 
 {
     m_leaveLabelWasUsed = false;
     m_leaveLabel = name;
-    EmitBasic("."+name);
-    Emit("psh bp");
-    Emit("mov bp sp");
+    m_program.SetLine(values.line);
+    EmitLabel(m_program.NamedLabel(name));
+    m_program.ExportLabel(m_program.NamedLabel(name));
+    Emit(Opcode::PSH, BP());
+    Emit(Opcode::MOV, BP(), SP());
+    m_trees = m_compiler.m_passes.Runs(PassId::TREE_SELECT);
+    m_selector.Reset();
+    // values still pending at the end are locals nothing reads any more, the epilogue drops them unpushed
     CompileValues(values);
     if (m_leaveLabelWasUsed) {
-        EmitBasic(GetLeave());
+        EmitLabel(GetLeave());
     }
-    Emit("mov sp bp");
-    Emit("pop bp");
-    Emit("ret");
+    Emit(Opcode::MOV, SP(), BP());
+    Emit(Opcode::POP, BP());
+    Emit(Opcode::RET);
 }
 
-std::string Compiler::GetLeave()
+uint32_t FunctionCompiler::GetLeave()
 {
     m_leaveLabelWasUsed = true;
-    return ".LEAVE"+m_leaveLabel+"_";
+    return m_program.NamedLabel(Symbols::Intern("LEAVE"+Symbols::Name(m_leaveLabel)+"_"));
+}
+
+void FunctionCompiler::CompileAsmFunction(Symbol name, const IRValues& values)
+{
+    m_program.SetLine(values.line);
+    EmitLabel(m_program.NamedLabel(name));
+    m_program.ExportLabel(m_program.NamedLabel(name));
+    for (auto& block: values.assembly) {
+        m_program.EmitAssembly(block);
+    }
+    Emit(Opcode::RET);
+}
+
+FunctionCompiler::FunctionCompiler(const Compiler& compiler)
+    : m_compiler(compiler), m_selector(m_program)
+{
+    m_trees = false;
+    m_leaveLabel = Symbols::NONE;
+    m_leaveLabelWasUsed = false;
+    m_name = Symbols::NONE;
+    m_sourceName = nullptr;
+    m_optimizer.SetRemarks(compiler.m_remarks);
+}
+
+static size_t CountInstructions(MachineProgram& program)
+{
+    size_t count = 0;
+    for (auto& block: program.Blocks()) {
+        count += block.instructions.size();
+    }
+    return count;
+}
+
+// The IR passes, each one that changes anything leaves its IR in the buffer the next one does not read
+const IRValues& FunctionCompiler::RunIRPasses(const IRValues& values)
+{
+    const IRValues* current = &values;
+    for (const Pass* pass: m_compiler.m_passes.Pipeline()) {
+        if (pass->kind != PassKind::IR)
+            continue;
+        Report::Scope scope(m_compiler.m_report, pass->phase);
+        IRValues& out = m_rewritten[current == &m_rewritten[0] ? 1 : 0];
+        switch (pass->id) {
+            case PassId::FOLD_CONSTANTS:
+                if (IRPasses::FoldConstants(*current, out)) {
+                    current = &out;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return *current;
+}
+
+void FunctionCompiler::RunMachinePasses()
+{
+    for (const Pass* pass: m_compiler.m_passes.Pipeline()) {
+        if (pass->kind != PassKind::MACHINE)
+            continue;
+        Report::Scope scope(m_compiler.m_report, pass->phase);
+        switch (pass->id) {
+            case PassId::PEEPHOLE:
+                m_optimizer.Optimize(m_program);
+                break;
+            case PassId::STACK_PAIRS:
+                m_optimizer.FoldStackPairs(m_program);
+                break;
+            case PassId::TAIL_DUPLICATE:
+                m_optimizer.DuplicateTails(m_program);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void FunctionCompiler::Compile(Symbol name, const IRValues& original, const std::string& sourceName)
+{
+    m_program.Reset();
+    m_errors.clear();
+    m_name = name;
+    m_sourceName = &sourceName;
+    const IRValues& values = RunIRPasses(original);
+    size_t before = 0;
+    {
+        Report::Scope scope(m_compiler.m_report, "codegen");
+        switch (values.type) {
+            case IRValuesType::FUNCTION:
+                CompileFunction(name, values);
+                break;
+            case IRValuesType::ASM_FUNCTION:
+                CompileAsmFunction(name, values);
+                break;
+        }
+        if (m_compiler.m_report || m_compiler.m_remarks) {
+            before = CountInstructions(m_program);
+            scope.Count("ir instructions", values.values.size());
+            scope.Count("machine instructions", before);
+        }
+    }
+    if (!m_errors.empty())
+        return;
+
+    size_t rewrites = m_optimizer.Rewrites();
+    {
+        Report::Scope scope(m_compiler.m_report, "optimize");
+        RunMachinePasses();
+        if (m_compiler.m_report) {
+            scope.Count("machine instructions", CountInstructions(m_program));
+        }
+    }
+    if (m_compiler.m_remarks) {
+        const PassManager& passes = m_compiler.m_passes;
+        m_optimizer.ExplainMissed(m_program, passes.Runs(PassId::PEEPHOLE), passes.Runs(PassId::STACK_PAIRS));
+        FormatRemarks(name, values, sourceName, before, m_optimizer.Rewrites() - rewrites);
+    }
 }
 
-void Compiler::CompileAsmFunction(const std::string& name, const std::vector<IRValue>& values)
+// Remarks print like diagnostics, tagged with the flag that asked for them
+void FunctionCompiler::FormatRemarks(Symbol name, const IRValues& values, const std::string& sourceName, size_t before, size_t rewrites)
 {
-    EmitBasic("."+name);
-    for (auto& str: values) {
-        Emit(std::get<std::string>(str));
+    std::vector<Remark>& remarks = m_optimizer.Remarks();
+    if (m_compiler.m_remarks->Wants(RemarkFilter::Kind::ANALYSIS, "peephole")) {
+        remarks.push_back({RemarkFilter::Kind::ANALYSIS, "peephole", values.line,
+            std::to_string(before) + " machine instructions became " + std::to_string(CountInstructions(m_program)) +
+            " at " + m_compiler.m_passes.LevelName() + " after " + std::to_string(rewrites) + " peephole rewrites"});
+    }
+    std::stable_sort(remarks.begin(), remarks.end(), [](const Remark& a, const Remark& b) { return a.line < b.line; });
+
+    std::ostringstream stream;
+    for (auto& remark: remarks) {
+        stream << "[REMARK]: " << sourceName << ':' << remark.line << ": " << Symbols::Name(name) << ": " << remark.message;
+        stream << " [" << RemarkFilter::FlagName(remark.kind) << '=' << remark.name << "]\n";
     }
-    Emit("ret");
+    m_remarks = stream.str();
+    remarks.clear();
+}
+
+MachineProgram& FunctionCompiler::Program()
+{
+    return m_program;
+}
+
+const URCLOptimizer& FunctionCompiler::Optimizer() const
+{
+    return m_optimizer;
+}
+
+const std::string& FunctionCompiler::Remarks() const
+{
+    return m_remarks;
+}
+
+const std::string& FunctionCompiler::Errors() const
+{
+    return m_errors;
+}
+
+// Writes out a finished program, its anonymous labels continue the numbering of the ones before it
+void Compiler::FlushProgram(MachineProgram& program)
+{
+    program.Flush(*m_output, m_labelBase);
+    m_labelBase += program.AnonymousLabels();
 }
 
+// Functions are compiled a window at a time on the pool and written in source order,
+// so only one window is ever held in machine IR and the output does not depend on -j
 void Compiler::CompileEverything()
 {
+    struct Function
+    {
+        Symbol name;
+        const IRValues* values;
+        const std::string* sourceName;
+    };
+    std::vector<Function> functions;
     for (auto& irInfo: m_irInfoList) {
         for (auto& global: irInfo.globals) {
 
@@ -365,51 +664,139 @@ void Compiler::CompileEverything()
             if (!m_references.count(global)) 
                 continue; 
 
-            switch (irValues.type) {
-                case IRValuesType::FUNCTION:
-                    CompileFunction(global, irValues.values);
-                    break;
-                case IRValuesType::ASM_FUNCTION:
-                    CompileAsmFunction(global, irValues.values);
-                    break;
+            if (irValues.type == IRValuesType::FUNCTION || irValues.type == IRValuesType::ASM_FUNCTION) {
+                functions.push_back({global, &irValues, &irInfo.sourceName});
+            }
+        }
+    }
+
+    size_t window = std::min(functions.size(), m_jobs * 4);
+    std::vector<std::unique_ptr<FunctionCompiler>> workers;
+    for (size_t i = 0; i < window; ++i) {
+        workers.push_back(std::make_unique<FunctionCompiler>(*this));
+    }
+
+    ThreadPool pool(m_jobs);
+    for (size_t start = 0; start < functions.size(); start += window) {
+        size_t count = std::min(window, functions.size() - start);
+        for (size_t i = 0; i < count; ++i) {
+            pool.Submit([&worker = *workers[i], &function = functions[start + i]] {
+                worker.Compile(function.name, *function.values, *function.sourceName);
+            });
+        }
+        pool.Wait();
+        // after an error the rest is still compiled to report its errors too, but no longer written
+        for (size_t i = 0; i < count; ++i) {
+            if (!workers[i]->Errors().empty()) {
+                std::cerr << workers[i]->Errors();
+                m_gotError = true;
+            }
+            if (m_gotError)
+                continue;
+            FlushProgram(workers[i]->Program());
+            if (m_remarks) {
+                std::cerr << workers[i]->Remarks();
             }
         }
     }
+
+    for (auto& worker: workers) {
+        m_optimizer.MergeStats(worker->Optimizer());
+    }
+
+    if (m_report) {
+        m_report->Count("functions compiled", functions.size());
+        m_report->Count("peephole windows", m_optimizer.Windows());
+        m_report->Count("peephole rewrites", m_optimizer.Rewrites());
+    }
+}
+
+void Compiler::SetPeepholeStats(bool enabled)
+{
+    m_peepholeStats = enabled;
+}
+
+bool Compiler::HasErrors() const
+{
+    return m_gotError;
+}
+
+void Compiler::SetJobs(size_t jobs)
+{
+    m_jobs = ThreadPool::Workers(jobs);
+}
+
+void Compiler::SetReport(Report* report)
+{
+    m_report = report;
+}
+
+void Compiler::SetPasses(const PassManager& passes)
+{
+    m_passes = passes;
 }
 
-void Compiler::LinkAndCompile(const std::vector<IRInfo>& irInfoList, const std::string& outputPath)
+void Compiler::SetRemarks(const RemarkFilter* filter)
 {
-    m_irInfoList = irInfoList;
+    m_remarks = filter && filter->Any() ? filter : nullptr;
+}
+
+void Compiler::LinkAndCompile(std::vector<IRInfo>&& irInfoList, const std::string& outputPath)
+{
+    m_irInfoList = std::move(irInfoList);
     m_gotError = false;
     m_heapBase = 0;
-    m_labels = 0;
+    m_labelBase = 0;
 
-    ResolveSymbols();
+    {
+        Report::Scope scope(m_report, "resolve symbols");
+        ResolveSymbols();
+    }
     if (m_gotError)
         return;
 
     std::ofstream outputFile(outputPath);
-    URCLOptimizer optimizer;
-
-    m_data << "\n//setup:\n";
-    m_data << "    BITS == 16\n";
-    m_data << "    MINSTACK 8192\n";
-    m_data << "    MINHEAP 8192\n";
-    m_data << "    @define bp r20\n";
+    OutputSink output(outputFile);
+    m_output = &output;
+
+    // the data section is complete before any code exists, so it goes out first
+    output << "\n//setup:\n";
+    output << "    BITS == 16\n";
+    output << "    MINSTACK 8192\n";
+    output << "    MINHEAP 8192\n";
+    output << "    @define bp r20\n";
     
-    m_data << "\n//data:\n";
+    output << "\n//data:\n";
 
-    CompileStrings();
+    {
+        Report::Scope scope(m_report, "compile strings");
+        CompileStrings();
+        scope.Count("strings", m_strings.size());
+    }
 
-    m_data << "    imm r25 " << m_heapBase << " // heap base\n";
+    output << "    imm r25 " << (int64_t)m_heapBase << " // heap base\n";
 
-    m_data << "\n//runtime:\n";
-    m_output << "    cal .main\n    hlt\n";
+    output << "\n//runtime:\n";
+    m_program.Reset();
+    m_program.Emit(Opcode::CAL, Operand::Label(m_program.NamedLabel(Symbols::Intern("main"))));
+    m_program.Emit(Opcode::HLT);
+    FlushProgram(m_program);
 
-    CompileEverything();
+    {
+        Report::Scope scope(m_report, "compile functions");
+        CompileEverything();
+        scope.Count("output bytes", output.BytesWritten());
+    }
+    if (m_peepholeStats) {
+        m_optimizer.PrintStats(std::cerr);
+    }
 
-    std::string output = m_output.str();
+    output.Flush();
+    m_output = nullptr;
 
-    outputFile << m_data.str();
-    outputFile << optimizer.Optimize(output);
-}
\ No newline at end of file
+    // a half written program is worse than none
+    if (m_gotError) {
+        outputFile.close();
+        std::remove(outputPath.c_str());
+    }
+}
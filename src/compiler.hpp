@@ -1,43 +1,105 @@
-
 #pragma once
 
 #include "ir.hpp"
+#include "machine_ir.hpp"
+#include "urcl_optimizer.hpp"
+#include "report.hpp"
+#include "remarks.hpp"
+#include "pass_manager.hpp"
+#include "tree_selector.hpp"
+
+#include <memory>
+
+class Compiler;
+
+// Compiles and optimizes one function at a time into its own machine program. It only reads the
+// linker tables, so several can run at once, anonymous labels start from zero in every function
+class FunctionCompiler
+{
+public:
+    explicit FunctionCompiler(const Compiler& compiler);
+
+    // runs the IR passes, codegen and then the machine passes
+    void Compile(Symbol name, const IRValues& values, const std::string& sourceName = "");
+    MachineProgram& Program();
+    const URCLOptimizer& Optimizer() const;
+    // the remarks of the last Compile, formatted and in source order
+    const std::string& Remarks() const;
+    // the errors of the last Compile, empty when it succeeded and its program is not worth flushing otherwise
+    const std::string& Errors() const;
+
+private:
+    // Function Info
+    const Compiler& m_compiler;
+    MachineProgram m_program;
+    URCLOptimizer m_optimizer;
+    TreeSelector m_selector;
+    bool m_trees; // codegen goes through m_selector
+    std::vector<uint32_t> m_whileStack;
+    std::vector<uint32_t> m_ifStack;
+    std::vector<uint32_t> m_ternaryStack;
+    Symbol m_leaveLabel;
+    bool m_leaveLabelWasUsed;
+    std::string m_remarks;
+    std::string m_errors;
+    Symbol m_name;
+    const std::string* m_sourceName;
+    IRValues m_rewritten[2]; // IR passes alternate between the two
+
+    // Emitter Functions
+    void Emit(Opcode opcode, Operand a = {}, Operand b = {}, Operand c = {});
+    void EmitLabel(uint32_t label);
+
+    // Compiler Functions
+    void CompileFunction(Symbol name, const IRValues& values);
+    void CompileAsmFunction(Symbol name, const IRValues& values);
+    void CompileValues(const IRValues& values);
+    const IRValues& RunIRPasses(const IRValues& values);
+    void RunMachinePasses();
+    void FormatRemarks(Symbol name, const IRValues& values, const std::string& sourceName, size_t before, size_t rewrites);
+    void Error(uint32_t line, const std::string& message);
+    void MakeBinop(Opcode op);
+    void BranchIfFalse(uint32_t label);
+    uint32_t MakeLabel();
+    uint32_t GetLeave();
+};
 
 class Compiler
 {
 public:
-    void LinkAndCompile(const std::vector<IRInfo>& irInfoList, const std::string& outputPath);
+    void LinkAndCompile(std::vector<IRInfo>&& irInfoList, const std::string& outputPath);
+    void SetPeepholeStats(bool enabled);
+    void SetJobs(size_t jobs);
+    void SetReport(Report* report);
+    void SetRemarks(const RemarkFilter* filter);
+    void SetPasses(const PassManager& passes);
+    bool HasErrors() const;
 
 private:
+    friend class FunctionCompiler;
+
     // Compiler Info
     std::vector<IRInfo> m_irInfoList;
     std::stringstream m_errors;
     bool m_gotError;
-    std::stringstream m_data;
-    std::stringstream m_output;
-    std::unordered_map<std::string, std::string> m_strings;
-    std::unordered_set<std::string> m_references;
-    std::vector<std::string> m_whileStack;
-    std::vector<std::string> m_ifStack;
-    std::vector<std::string> m_ternaryStack;
+    OutputSink* m_output;
+    MachineProgram m_program;
+    URCLOptimizer m_optimizer;
+    uint32_t m_labelBase;
+    std::unordered_map<Symbol, int32_t> m_strings;
+    std::unordered_set<Symbol> m_references;
+    std::unordered_map<Symbol, IRGlobalInfo*> m_symbols;
     size_t m_heapBase;
-    size_t m_labels;
-    std::string m_leaveLabel;
-    bool m_leaveLabelWasUsed;
-
-    // Emitter Functions
-    void Emit(const std::string& string);
-    void EmitBasic(const std::string& string);
+    size_t m_jobs = 1;
+    bool m_peepholeStats = false;
+    Report* m_report = nullptr;
+    const RemarkFilter* m_remarks = nullptr;
+    PassManager m_passes;
 
     // Compiler Functions
-    IRValues GetGlobalValues(const std::string& name);
+    const IRValues* GetGlobalValues(Symbol name) const;
     void ResolveSymbols();
     void CompileStrings();
     void CompileEverything();
-    void CompileFunction(const std::string& name, const std::vector<IRValue>& values);
-    void CompileAsmFunction(const std::string& name, const std::vector<IRValue>& values);
-    void CompileValues(const std::vector<IRValue>& value);
-    void MakeBinop(const std::string& op);
-    std::string MakeLabel();
-    std::string GetLeave();
-};
\ No newline at end of file
+    void FlushProgram(MachineProgram& program);
+};
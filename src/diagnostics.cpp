@@ -0,0 +1,72 @@
+#include "diagnostics.hpp"
+
+#include <iostream>
+#include <streambuf>
+#include <mutex>
+
+static thread_local std::string* t_capture = nullptr;
+
+// Stands in for the real buffer of std::cout and std::cerr, forwarding to it unless the
+// writing thread is capturing
+class RoutedBuffer : public std::streambuf
+{
+public:
+    explicit RoutedBuffer(std::streambuf* target) : m_target(target) {}
+
+protected:
+    int overflow(int c) override
+    {
+        if (c == traits_type::eof())
+            return traits_type::not_eof(c);
+        if (t_capture) {
+            t_capture->push_back((char)c);
+            return c;
+        }
+        return m_target->sputc((char)c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+        if (t_capture) {
+            t_capture->append(data, size);
+            return size;
+        }
+        return m_target->sputn(data, size);
+    }
+
+    int sync() override
+    {
+        return t_capture ? 0 : m_target->pubsync();
+    }
+
+private:
+    std::streambuf* m_target;
+};
+
+static void InstallRouting()
+{
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        static RoutedBuffer errors(std::cerr.rdbuf());
+        static RoutedBuffer messages(std::cout.rdbuf());
+        std::cerr.rdbuf(&errors);
+        std::cout.rdbuf(&messages);
+    });
+}
+
+Diagnostics::Capture::Capture()
+{
+    InstallRouting();
+    m_previous = t_capture;
+    t_capture = &m_text;
+}
+
+Diagnostics::Capture::~Capture()
+{
+    t_capture = m_previous;
+}
+
+const std::string& Diagnostics::Capture::Text() const
+{
+    return m_text;
+}
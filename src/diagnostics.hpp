@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// Everything in the compiler reports straight to std::cerr (and the usage to std::cout). While a
+// Capture is alive, whatever the current thread writes to either stream lands in the capture instead,
+// so several compiles can run side by side and still report one after another
+namespace Diagnostics
+{
+    class Capture
+    {
+    public:
+        Capture();
+        ~Capture();
+        Capture(const Capture&) = delete;
+        Capture& operator=(const Capture&) = delete;
+
+        const std::string& Text() const;
+
+    private:
+        std::string m_text;
+        std::string* m_previous;
+    };
+}
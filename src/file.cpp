@@ -1,20 +1,75 @@
-
 #include "file.hpp"
 
 #include <fstream>
 #include <sstream>
-#include <iostream>
 
-std::string File::ReadEverything(const std::string& path)
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+bool File::ReadEverything(const std::string& path, std::string& contents)
 {
     std::ifstream file(path);
-    if (!file) {
-        std::cerr << "[FATAL ERROR]: could not find file '" << path << "'\n";
-        std::cerr << "Compilation Terminated.";
-        file.close();
-        exit(1);
-    }
+    if (!file)
+        return false;
     std::stringstream stream; 
     stream << file.rdbuf();
-    return stream.str();
-}
\ No newline at end of file
+    contents = stream.str();
+    return true;
+}
+
+// Mapping
+File::Mapping::~Mapping()
+{
+    Close();
+}
+
+void File::Mapping::Close()
+{
+#ifndef _WIN32
+    if (m_mapped) {
+        munmap((void*)m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_fallback.clear();
+}
+
+bool File::Mapping::Open(const std::string& path)
+{
+    Close();
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) 
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = (const char*)data;
+            m_size = info.st_size;
+            m_mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+    close(fd);
+#endif
+    // empty files cannot be mapped, and other platforms read the file instead
+    if (!ReadEverything(path, m_fallback))
+        return false;
+    m_data = m_fallback.data();
+    m_size = m_fallback.size();
+    return true;
+}
+
+std::string_view File::Mapping::View() const
+{
+    return std::string_view(m_data, m_size);
+}
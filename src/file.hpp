@@ -1,9 +1,31 @@
-
 #pragma once
 
 #include <string>
+#include <string_view>
 
 namespace File 
 {
-    std::string ReadEverything(const std::string& file_path);
-}
\ No newline at end of file
+    // false when the file cannot be opened, the caller reports it
+    bool ReadEverything(const std::string& file_path, std::string& contents);
+
+    // Read-only view of a whole file, memory-mapped where the platform supports it
+    class Mapping
+    {
+    public:
+        Mapping() = default;
+        ~Mapping();
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        bool Open(const std::string& path);
+        std::string_view View() const;
+
+    private:
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+        bool m_mapped = false;
+        std::string m_fallback;
+
+        void Close();
+    };
+}
@@ -0,0 +1,321 @@
+#include "incremental.hpp"
+#include "top_level.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+// Symbols whose membership in one IRInfo set differs from before the edit, mapped to whether they were in it
+using MembershipChanges = std::unordered_map<Symbol, bool>;
+
+static size_t CountLines(std::string_view text)
+{
+    return std::count(text.begin(), text.end(), '\n');
+}
+
+// `before` and `after` are what the old and new items appended to `set`, both saw the same set up to `changes`
+static void UpdateChanges(MembershipChanges& changes, const SymbolSet& set, const std::vector<Symbol>& before, const std::vector<Symbol>& after)
+{
+    MembershipChanges wasIn = std::move(changes);
+    for (Symbol symbol: before) {
+        wasIn[symbol] = true;
+    }
+    for (Symbol symbol: after) {
+        wasIn.emplace(symbol, false);
+    }
+
+    changes.clear();
+    for (auto& [symbol, was]: wasIn) {
+        if (was != (set.count(symbol) != 0)) {
+            changes.emplace(symbol, was);
+        }
+    }
+}
+
+static bool Mentions(const std::vector<Symbol>& mentions, const MembershipChanges& changes)
+{
+    for (auto& change: changes) {
+        if (std::binary_search(mentions.begin(), mentions.end(), change.first))
+            return true;
+    }
+    return false;
+}
+
+void IncrementalUnit::SetSourceName(const std::string& name)
+{
+    m_sourceName = name;
+}
+
+// Incremental Functions
+std::vector<IncrementalUnit::Item> IncrementalUnit::SplitRange(size_t begin, size_t end, size_t line, bool& complete) const
+{
+    Lexer lexer;
+    auto tokens = lexer.Tokenize(std::string_view(m_source).substr(begin, end - begin), line);
+
+    // a token carries the line it ends on, so an item's first line is counted from the text before it
+    std::vector<Item> items;
+    size_t counted = begin;
+    complete = true;
+    for (auto& split: TopLevel::Split(tokens)) {
+        const Token& first = tokens[split.first];
+        const Token& last = tokens[split.last - 1];
+        Item item = {};
+        item.offset = begin + first.offset;
+        item.length = last.offset + last.length - first.offset;
+        line += CountLines(std::string_view(m_source).substr(counted, item.offset - counted));
+        counted = item.offset;
+        item.line = line;
+        item.lastLine = last.line;
+        for (size_t i = split.first; i < split.last; ++i) {
+            if (tokens[i].type == TokenType::IDENT) {
+                item.mentions.push_back(tokens[i].symbol);
+            }
+        }
+        std::sort(item.mentions.begin(), item.mentions.end());
+        item.mentions.erase(std::unique(item.mentions.begin(), item.mentions.end()), item.mentions.end());
+        items.push_back(std::move(item));
+        complete = split.complete;
+    }
+    return items;
+}
+
+void IncrementalUnit::Generate(Item& item, size_t previousLine)
+{
+    item.globalsBefore = m_irInfo.globals.size();
+    item.referencesBefore = m_irInfo.references.size();
+    item.stringsBefore = m_irInfo.strings.size();
+
+    // anything it adds to the Symbols::NONE entry, even a reference, counts
+    auto looseSize = [this] {
+        auto loose = m_irInfo.globalsMap.find(Symbols::NONE);
+        if (loose == m_irInfo.globalsMap.end())
+            return SIZE_MAX;
+        return loose->second.irValues.values.size() + loose->second.references.size();
+    };
+    size_t looseBefore = looseSize();
+
+    IRGenerator irGen;
+    irGen.SetSourceName(m_sourceName);
+    irGen.GenerateInto(m_irInfo, std::string_view(m_source).substr(item.offset), item.line, previousLine, item.length);
+    item.errors = irGen.ErrorText();
+    item.redefined = irGen.Redefined();
+
+    item.loose = looseSize() != looseBefore;
+    m_loose += item.loose;
+
+    item.globals.assign(m_irInfo.globals.begin() + item.globalsBefore, m_irInfo.globals.end());
+    item.references.assign(m_irInfo.references.begin() + item.referencesBefore, m_irInfo.references.end());
+
+    // Literals are only ever loaded inside a global, and every load adds its string to the set
+    SymbolSet strings;
+    item.calls.clear();
+    for (Symbol global: item.globals) {
+        for (auto& value: m_irInfo.globalsMap[global].irValues.values) {
+            if (value.type == IRType::LOAD_STRING) {
+                strings.insert(value.symbol);
+            } else if (value.type == IRType::CALL_FUNCTION && m_irInfo.globals.count(value.symbol)) {
+                item.calls.push_back(value.symbol);
+                m_callers[value.symbol] += 1;
+            }
+        }
+    }
+    item.strings.assign(strings.begin(), strings.end());
+    m_regenerated += 1;
+}
+
+void IncrementalUnit::Replay(Item& item)
+{
+    item.globalsBefore = m_irInfo.globals.size();
+    item.referencesBefore = m_irInfo.references.size();
+    item.stringsBefore = m_irInfo.strings.size();
+
+    m_irInfo.globals.insert(item.globals.begin(), item.globals.end());
+    m_irInfo.references.insert(item.references.begin(), item.references.end());
+    m_irInfo.strings.insert(item.strings.begin(), item.strings.end());
+    for (Symbol callee: item.calls) {
+        m_irInfo.globalsMap[callee].references.insert(callee);
+    }
+}
+
+// Reused IR still carries the lines it was generated at
+void IncrementalUnit::ShiftLines(const Item& item, int64_t delta)
+{
+    if (delta == 0)
+        return;
+    for (Symbol global: item.globals) {
+        IRValues& irValues = m_irInfo.globalsMap[global].irValues;
+        irValues.line += delta;
+        for (auto& line: irValues.lines) {
+            line.second += delta;
+        }
+    }
+}
+
+void IncrementalUnit::Forget(const Item& item)
+{
+    for (Symbol global: item.globals) {
+        m_irInfo.globalsMap.erase(global);
+    }
+    if (item.loose && --m_loose == 0) {
+        m_irInfo.globalsMap.erase(Symbols::NONE);
+    }
+
+    // A callee's own name is only ever appended after its body, once nothing calls it that goes again
+    for (Symbol callee: item.calls) {
+        if (--m_callers[callee] != 0)
+            continue;
+        m_callers.erase(callee);
+        auto found = m_irInfo.globalsMap.find(callee);
+        if (found == m_irInfo.globalsMap.end())
+            continue;
+        SymbolSet& references = found->second.references;
+        if (!references.empty() && *(references.end() - 1) == callee) {
+            references.truncate(references.size() - 1);
+        }
+    }
+}
+
+void IncrementalUnit::Open(std::string source)
+{
+    m_source = std::move(source);
+    m_irInfo = IRInfo();
+    m_irInfo.sourceName = m_sourceName;
+    m_callers.clear();
+    m_loose = 0;
+    m_regenerated = 0;
+
+    bool complete;
+    m_items = SplitRange(0, m_source.size(), 1, complete);
+    for (size_t i = 0; i < m_items.size(); ++i) {
+        Generate(m_items[i], i ? m_items[i - 1].lastLine : 0);
+    }
+}
+
+void IncrementalUnit::Edit(size_t offset, size_t removed, std::string_view inserted)
+{
+    offset = std::min(offset, m_source.size());
+    removed = std::min(removed, m_source.size() - offset);
+    size_t editEnd = offset + removed;
+    int64_t delta = (int64_t)inserted.size() - (int64_t)removed;
+    int64_t lineDelta = (int64_t)CountLines(inserted) - (int64_t)CountLines(std::string_view(m_source).substr(offset, removed));
+
+    // A global defined twice had its first entry clobbered, only generating the whole file again brings it back
+    bool clobbered = std::any_of(m_items.begin(), m_items.end(), [](const Item& item) { return !item.redefined.empty(); });
+    if (clobbered) {
+        m_source.replace(offset, removed, inserted);
+        Open(std::move(m_source));
+        return;
+    }
+
+    // Replaced Items, the one the edit starts in (or follows) up to the first one starting after it
+    auto startsAfter = [](size_t value, const Item& item) { return value < item.offset; };
+    size_t count = m_items.size();
+    size_t first = std::upper_bound(m_items.begin(), m_items.end(), offset, startsAfter) - m_items.begin();
+    first = first ? first - 1 : 0;
+    // text at the very start of an item may just as well end the one before, like a trailing ';'
+    if (first > 0 && m_items[first].offset == offset) {
+        first -= 1;
+    }
+    size_t last = std::upper_bound(m_items.begin(), m_items.end(), editEnd, startsAfter) - m_items.begin();
+    last = std::max(last, std::min(first + 1, count));
+
+    bool fromStart = count == 0 || m_items[first].offset > offset;
+    size_t begin = fromStart ? 0 : m_items[first].offset;
+    size_t line = fromStart ? 1 : m_items[first].line;
+
+    m_source.replace(offset, removed, inserted);
+
+    // Relex only up to the next untouched item, growing the range while an item runs past its end
+    std::vector<Item> added;
+    while (true) {
+        size_t end = last < count ? m_items[last].offset + delta : m_source.size();
+        bool complete;
+        added = SplitRange(begin, end, line, complete);
+        if (complete || last == count)
+            break;
+        last = std::min(count, last + std::max<size_t>(last - first, 1));
+    }
+
+    // Rewind the IRInfo to the state before the first replaced item
+    if (first < count) {
+        m_irInfo.globals.truncate(m_items[first].globalsBefore);
+        m_irInfo.references.truncate(m_items[first].referencesBefore);
+        m_irInfo.strings.truncate(m_items[first].stringsBefore);
+    }
+    for (size_t i = first; i < last; ++i) {
+        Forget(m_items[i]);
+    }
+
+    m_regenerated = 0;
+    std::vector<Symbol> globalsBefore, referencesBefore, globalsAfter, referencesAfter;
+    for (size_t i = first; i < last; ++i) {
+        globalsBefore.insert(globalsBefore.end(), m_items[i].globals.begin(), m_items[i].globals.end());
+        referencesBefore.insert(referencesBefore.end(), m_items[i].references.begin(), m_items[i].references.end());
+    }
+    size_t previousLine = first ? m_items[first - 1].lastLine : 0;
+    for (auto& item: added) {
+        Generate(item, previousLine);
+        previousLine = item.lastLine;
+        globalsAfter.insert(globalsAfter.end(), item.globals.begin(), item.globals.end());
+        referencesAfter.insert(referencesAfter.end(), item.references.begin(), item.references.end());
+    }
+
+    // Later items only read which names are globals or references, so only ones mentioning a changed name go again
+    MembershipChanges globals, references;
+    UpdateChanges(globals, m_irInfo.globals, globalsBefore, globalsAfter);
+    UpdateChanges(references, m_irInfo.references, referencesBefore, referencesAfter);
+
+    m_items.erase(m_items.begin() + first, m_items.begin() + last);
+    m_items.insert(m_items.begin() + first, std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+
+    // Ones with errors always go again, their diagnostics carry line numbers and they may clobber earlier globals
+    for (size_t i = first + added.size(); i < m_items.size(); ++i) {
+        Item& item = m_items[i];
+        item.offset += delta;
+        item.line += lineDelta;
+        item.lastLine += lineDelta;
+        if (!item.errors.empty() || Mentions(item.mentions, globals) || Mentions(item.mentions, references)) {
+            std::vector<Symbol> oldGlobals = item.globals;
+            std::vector<Symbol> oldReferences = item.references;
+            Forget(item);
+            Generate(item, i ? m_items[i - 1].lastLine : 0);
+            UpdateChanges(globals, m_irInfo.globals, oldGlobals, item.globals);
+            UpdateChanges(references, m_irInfo.references, oldReferences, item.references);
+        } else {
+            ShiftLines(item, lineDelta);
+            Replay(item);
+        }
+    }
+}
+
+const std::string& IncrementalUnit::Source() const
+{
+    return m_source;
+}
+
+const IRInfo& IncrementalUnit::GetIRInfo() const
+{
+    return m_irInfo;
+}
+
+bool IncrementalUnit::HasErrors() const
+{
+    for (auto& item: m_items) {
+        if (!item.errors.empty())
+            return true;
+    }
+    return false;
+}
+
+std::string IncrementalUnit::Errors() const
+{
+    std::string errors;
+    for (auto& item: m_items) {
+        errors += item.errors;
+    }
+    return errors;
+}
+
+size_t IncrementalUnit::Regenerated() const
+{
+    return m_regenerated;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Keeps one source file split into its top-level items (functions, asm functions, global variables
+// and anything else GenStmt accepts at the top) so an edit only relexes the items it touched and only
+// regenerates their IR, plus later items mentioning a name that became or stopped being a global or reference.
+// The file's IRInfo is patched in place and matches a full IRGenerator::Generate whenever the file has no errors
+class IncrementalUnit
+{
+public:
+    void SetSourceName(const std::string& name);
+    void Open(std::string source);
+    // replaces `removed` bytes at `offset` with `inserted`
+    void Edit(size_t offset, size_t removed, std::string_view inserted);
+
+    const std::string& Source() const;
+    const IRInfo& GetIRInfo() const;
+    bool HasErrors() const;
+    std::string Errors() const;
+    // how many items the last Open or Edit generated, the rest were reused
+    size_t Regenerated() const;
+
+private:
+    struct Item
+    {
+        size_t offset, length, line;
+        size_t lastLine; // where its last token ends, an error at the start of the next item points there
+        std::string errors;
+
+        // What generating the item added to the file's IRInfo, replayed when it is reused. Strings are
+        // every literal it loads, the rest only what was new, the identifiers it mentions tell when that changes
+        std::vector<Symbol> globals;
+        std::vector<Symbol> references;
+        std::vector<Symbol> strings;
+        std::vector<Symbol> mentions;
+        // earlier globals the item calls, calling one records it in that global's own references
+        std::vector<Symbol> calls;
+        // earlier globals the item defined again, while there are any every edit regenerates the whole file
+        std::vector<Symbol> redefined;
+        size_t globalsBefore, referencesBefore, stringsBefore;
+        // it touched the entry of Symbols::NONE, which statements outside any global use
+        bool loose;
+    };
+
+    // Unit Info
+    std::string m_sourceName;
+    std::string m_source;
+    std::vector<Item> m_items;
+    IRInfo m_irInfo;
+    std::unordered_map<Symbol, size_t> m_callers;
+    size_t m_loose = 0; // items keeping the Symbols::NONE entry alive
+    size_t m_regenerated = 0;
+
+    // Incremental Functions
+    std::vector<Item> SplitRange(size_t begin, size_t end, size_t line, bool& complete) const;
+    void Generate(Item& item, size_t previousLine);
+    void Replay(Item& item);
+    void ShiftLines(const Item& item, int64_t delta);
+    void Forget(const Item& item);
+};
@@ -71,14 +71,14 @@ std::string IRGenerator::UnescapeString(const std::string& input)
 }
 
 // Source Functions
-Token& IRGenerator::At()
+Token IRGenerator::At()
 {
-    return m_tokens[m_tokenIndex];
+    return m_tokens.Peek();
 }
 
-Token& IRGenerator::Eat()
+Token IRGenerator::Eat()
 {
-    Token& t = At();
+    Token t = At();
     Advance();
     return t;
 }
@@ -92,19 +92,31 @@ void IRGenerator::Advance()
 {
     if (Type() == TokenType::END_OF_FILE)
         return;
-    m_tokenIndex += 1;
+    m_tokens.Advance();
 }
 
-Token& IRGenerator::Next(int i)
+Token IRGenerator::Next(int i)
 {
-    return m_tokens[(int)m_tokenIndex + i];
+    return m_tokens.Peek(i);
 }
 
-Token& IRGenerator::Expect(TokenType type, const std::string& messsage)
+std::string IRGenerator::Value(const Token& token)
 {
-    Token& t = Eat();
+    return std::string(Lexer::Text(token, m_source));
+}
+
+Symbol IRGenerator::SymbolOf(const Token& token)
+{
+    if (token.type == TokenType::IDENT)
+        return token.symbol;
+    return Symbols::Intern(Lexer::Text(token, m_source));
+}
+
+Token IRGenerator::Expect(TokenType type, const std::string& messsage)
+{
+    Token t = Eat();
     if (t.type != type) {
-        Error(messsage+", got '"+t.value+"'");
+        Error(messsage+", got '"+Value(t)+"'");
     }
     return t;
 }
@@ -126,7 +138,7 @@ void IRGenerator::ExpectSemicolon()
 // I'm crying
 IRType IRGenerator::EatOperand()
 {
-    Token& t = Eat();
+    Token t = Eat();
     switch (t.type) {
         CaseOperand(TokenType::PLUS, IRType::ADD);
         CaseOperand(TokenType::MINUS, IRType::SUB);
@@ -144,72 +156,85 @@ IRType IRGenerator::EatOperand()
 }
 
 // Emit Functions
-void IRGenerator::AddGlobal(const std::string& label, IRValuesType type)
+void IRGenerator::AddGlobal(Symbol label, IRValuesType type)
 {
     if (m_irInfo.globals.count(label)) {
-        Error("global '"+label+"' already exists");
+        Error("global '"+Symbols::Name(label)+"' already exists");
+        m_redefined.push_back(label);
     }
     IRValues values;
     values.type = type;
+    values.line = (m_tokens.Position() == 0 ? At() : Next(-1)).line;
 
     m_irInfo.globals.insert(label);
     GetIRValues(label) = std::move(values);
     m_currentGlobal = label;
 }
-void IRGenerator::Emit(std::initializer_list<IRValue> value)
+void IRGenerator::Emit(IRType type, int32_t operand, Symbol symbol)
 {
-    for (IRValue v: value) {
-        if (m_currentGlobal == "?") 
-            continue;
-        GetIRValues().values.emplace_back(v);
-    }
-}
-
-void IRGenerator::Emit(const IRValue& value)
-{
-    if (m_currentGlobal == "?") 
+    if (m_currentGlobal == Symbols::NONE) 
         return;
-    GetIRValues().values.emplace_back(value);
+    IRValues& values = GetIRValues();
+    uint32_t line = (m_tokens.Position() == 0 ? At() : Next(-1)).line;
+    if (values.lines.empty() || values.lines.back().second != line) {
+        values.lines.emplace_back(values.values.size(), line);
+    }
+    values.values.push_back({type, operand, symbol});
 }
 
 // IR Stack Related
-std::optional<int> IRGenerator::GetLocal(const std::string& name, bool autoExtern)
+std::optional<int> IRGenerator::GetLocal(Symbol name, bool autoExtern)
 {
-    for (int i = (int)m_locals.size() - 1; i >= 0; --i) {
-        auto& scope = m_locals[i];
-        if (scope.find(name) != scope.end()) {
-            return -scope[name];
-        }
+    auto found = m_locals.find(name);
+    if (found != m_locals.end()) {
+        return found->second;
     }
-    if (m_params.find(name) != m_params.end()) {
-        return m_params[name];
-    }
-    if (m_currentGlobal != "?" && autoExtern) {
+    if (m_currentGlobal != Symbols::NONE && autoExtern) {
         m_irInfo.references.insert(name);
     }
     
     return {};
 }
 
+void IRGenerator::SetLocal(Symbol name, int offset)
+{
+    auto found = m_locals.find(name);
+    if (found != m_locals.end()) {
+        m_localsUndo.emplace_back(name, found->second);
+        found->second = offset;
+    } else {
+        m_localsUndo.emplace_back(name, std::nullopt);
+        m_locals.emplace(name, offset);
+    }
+}
 
-void IRGenerator::PushLocal(const std::string& name)
+void IRGenerator::PushLocal(Symbol name)
 {
-    auto& scope = m_locals.back();
-    scope[name] = m_localsSize++;
+    SetLocal(name, -(int)m_localsSize++);
     m_localTotal += 1;
 }
 
 void IRGenerator::PushBlock()
 {
-    m_localsSizeStack.push_back(m_localsSize);
-    m_locals.emplace_back();
+    m_blocks.emplace_back(m_localsUndo.size(), m_localsSize);
 }
 
 void IRGenerator::PopBlock()
 {
-    m_localsSize = m_localsSizeStack.back();
-    m_locals.pop_back();
-    m_localsSizeStack.pop_back();
+    auto [undoSize, localsSize] = m_blocks.back();
+    m_blocks.pop_back();
+    m_localsSize = localsSize;
+
+    // unwind newest first so a name declared twice in one block ends at its outer offset
+    while (m_localsUndo.size() > undoSize) {
+        auto& [name, previous] = m_localsUndo.back();
+        if (previous.has_value()) {
+            m_locals[name] = previous.value();
+        } else {
+            m_locals.erase(name);
+        }
+        m_localsUndo.pop_back();
+    }
 }
 
 // IR Getters
@@ -218,12 +243,12 @@ IRValues& IRGenerator::GetIRValues()
     return m_irInfo.globalsMap[m_currentGlobal].irValues;
 }
 
-IRValues& IRGenerator::GetIRValues(const std::string& name)
+IRValues& IRGenerator::GetIRValues(Symbol name)
 {
     return m_irInfo.globalsMap[name].irValues;
 }
 
-IRGlobalInfo& IRGenerator::GetIRGlobal(const std::string& name)
+IRGlobalInfo& IRGenerator::GetIRGlobal(Symbol name)
 {
     return m_irInfo.globalsMap[name];
 }
@@ -236,42 +261,43 @@ IRGlobalInfo& IRGenerator::GetIRGlobal()
 // IR  Expr Functions
 void IRGenerator::GenPrimary()
 {
-    Token& t = Eat();
+    Token t = Eat();
 
-    if (m_currentGlobal == "?")
+    if (m_currentGlobal == Symbols::NONE)
         return;
 
     switch (t.type) {
         case TokenType::NUMBER: {
-            Emit({IRType::LOAD_NUMBER, t.value}); 
+            Emit(IRType::LOAD_NUMBER, Lexer::NumberValue(Lexer::Text(t, m_source)));
             break;
         }
         case TokenType::STRING: {
-            std::string string = UnescapeString(t.value);
+            Symbol string = Symbols::Intern(UnescapeString(Value(t)));
             m_irInfo.strings.insert(string); 
-            Emit({IRType::LOAD_STRING, string});
+            Emit(IRType::LOAD_STRING, 0, string);
             break;
         }
         case TokenType::CHAR: {
             size_t i = 0;
-            Emit({IRType::LOAD_NUMBER, std::to_string(ParseEscape(t.value, i))});
+            Emit(IRType::LOAD_NUMBER, ParseEscape(Value(t), i));
             break;
         }
         case TokenType::IDENT: {
-            auto local = GetLocal(t.value);
+            Symbol name = t.symbol;
+            auto local = GetLocal(name);
 
             if (local.has_value()) {
-                Emit({IRType::LOAD_FROMBASE, std::to_string(local.value())});
+                Emit(IRType::LOAD_FROMBASE, local.value());
                 break;
             }
 
-            if (m_irInfo.references.count(t.value)) {
-                Emit({IRType::LOAD_GLOBAL, t.value});
+            if (m_irInfo.references.count(name)) {
+                Emit(IRType::LOAD_GLOBAL, 0, name);
                 break;
             }
-            if (m_irInfo.globals.count(t.value)) {
-                Emit({IRType::LOAD_GLOBAL, t.value});
-                GetIRGlobal(m_currentGlobal).references.insert(t.value);
+            if (m_irInfo.globals.count(name)) {
+                Emit(IRType::LOAD_GLOBAL, 0, name);
+                GetIRGlobal(m_currentGlobal).references.insert(name);
                 break;
             }
 
@@ -283,7 +309,7 @@ void IRGenerator::GenPrimary()
             break;
         }
         default: {
-            Error("unexpected symbol '"+t.value+"'");
+            Error("unexpected symbol '"+Value(t)+"'");
             break;
         }
     }
@@ -292,21 +318,22 @@ void IRGenerator::GenPrimary()
 void IRGenerator::GenCall()
 {
     if (Next().type == TokenType::OPENPAREN) {
-        Token& t = At();
+        Token t = At();
+        Symbol name = t.symbol;
         bool isGlobalFunction = false;
         bool isGlobalLocal = false;
         if (t.type == TokenType::IDENT) {
-            auto local = GetLocal(t.value);
+            auto local = GetLocal(name);
 
-            isGlobalFunction = m_irInfo.references.count(t.value) && !local.has_value();
-            isGlobalLocal = m_irInfo.globals.count(t.value);
+            isGlobalFunction = m_irInfo.references.count(name) && !local.has_value();
+            isGlobalLocal = m_irInfo.globals.count(name);
         }
         if (!isGlobalFunction) {
             GenPrimary();
         } else {
-            m_irInfo.references.insert(t.value);
+            m_irInfo.references.insert(name);
             if (isGlobalLocal) {
-                GetIRGlobal(t.value).references.insert(t.value);
+                GetIRGlobal(name).references.insert(name);
             }
             Advance();
         }
@@ -325,9 +352,9 @@ void IRGenerator::GenCall()
         Expect(TokenType::CLOSEPAREN, "expected ')' when closing argument list");
 
         if (isGlobalFunction) {
-            Emit({IRType::CALL_FUNCTION, t.value, std::to_string(count)});
+            Emit(IRType::CALL_FUNCTION, count, name);
         } else {
-            Emit({IRType::CALL, std::to_string(count)});
+            Emit(IRType::CALL, count);
         }
         Emit(IRType::LOAD_RETURNED);
     } else {
@@ -345,15 +372,16 @@ void IRGenerator::GenUnary()
         } 
     } else if (Type() == TokenType::AMPERSAND) {
         Advance();
-        Token& value = Expect(TokenType::IDENT, "expected lvalue next to address-of operator");
+        Token value = Expect(TokenType::IDENT, "expected lvalue next to address-of operator");
         if (value.type == TokenType::IDENT) {
-            if (m_irInfo.globals.count(value.value)) {
-                Emit({IRType::REF_GLOBAL, value.value});
+            Symbol name = value.symbol;
+            if (m_irInfo.globals.count(name)) {
+                Emit(IRType::REF_GLOBAL, 0, name);
                 return;
             }
-            auto local = GetLocal(value.value);
+            auto local = GetLocal(name);
             if (local.has_value()) {
-                Emit({IRType::REF_FROMBASE, std::to_string(local.value())});
+                Emit(IRType::REF_FROMBASE, local.value());
             }
         }
     } else if (Type() == TokenType::NOT) {
@@ -442,31 +470,31 @@ void IRGenerator::GenFunction()
     if (m_functionDepth) {
         Error("cannot define function here");
     }
-    const std::string& name = Eat().value;
+    Symbol name = SymbolOf(Eat());
     m_functionDepth += 1;
 
     AddGlobal(name, IRValuesType::FUNCTION);
     Advance();
     m_irInfo.globals.emplace(name);
-    m_params.clear();
+    m_locals.clear();
 
 
     size_t param = 1;
-    std::vector<std::string> params;
+    std::vector<Symbol> params;
 
     if (Type() != TokenType::CLOSEPAREN) {
-        Token& t = Expect(TokenType::IDENT, "invalid parameter #1");
+        Token t = Expect(TokenType::IDENT, "invalid parameter #1");
         if (t.type == TokenType::IDENT) 
-            params.push_back(t.value);
+            params.push_back(t.symbol);
         param += 1;
     }
 
     while (Type() != TokenType::CLOSEPAREN && Type() != TokenType::END_OF_FILE) {
         Expect(TokenType::COMMA, "expected ',' beside parameter #"+std::to_string(param-1));
 
-        Token& t = Expect(TokenType::IDENT, "invalid parameter #"+std::to_string(param));
+        Token t = Expect(TokenType::IDENT, "invalid parameter #"+std::to_string(param));
         if (t.type == TokenType::IDENT) 
-            params.push_back(t.value);
+            params.push_back(t.symbol);
         param += 1;
     }
 
@@ -475,14 +503,15 @@ void IRGenerator::GenFunction()
     if (params.size() != param-1) 
         return;
 
-    for (auto& p: params) {
-        m_params[p] = param--;
+    for (Symbol p: params) {
+        m_locals[p] = param--;
     }
 
     GenStmt();
-    m_params.clear();
+    m_locals.clear();
+    m_localsUndo.clear();
     m_functionDepth -= 1;
-    m_currentGlobal = "?";
+    m_currentGlobal = Symbols::NONE;
 }
 
 void IRGenerator::GenBlock()
@@ -501,18 +530,18 @@ void IRGenerator::GenBlock()
 
 void IRGenerator::GenVarDecl()
 {
-    const std::string& var = Eat().value;
+    Symbol var = SymbolOf(Eat());
     auto local = GetLocal(var, false);
     Advance();
     if (!m_functionDepth) {
         GenPrimary();
         AddGlobal(var, IRValuesType::VARIABLE);
-        m_currentGlobal = "?";
+        m_currentGlobal = Symbols::NONE;
         return;
     }
     if (local.has_value()) {
         GenExpr();
-        Emit({IRType::ASSIGN_FROMBASE, std::to_string(local.value())});
+        Emit(IRType::ASSIGN_FROMBASE, local.value());
         return;
     } else {
         if (m_irInfo.globals.count(var)) {
@@ -520,7 +549,7 @@ void IRGenerator::GenVarDecl()
                 Error("cannot assign to a non global variable");
                 return;
             }
-            Emit({IRType::ASSIGN_GLOBAL, var});
+            Emit(IRType::ASSIGN_GLOBAL, 0, var);
             return;
         }
         GenExpr();
@@ -534,27 +563,27 @@ void IRGenerator::GenAsmFunction()
         Error("cannot define assembly function here");
     }
     m_functionDepth += 1;
-    const std::string& name = Eat().value;
+    Symbol name = SymbolOf(Eat());
     Advance();
     AddGlobal(name, IRValuesType::ASM_FUNCTION);
-    auto& block = GetIRValues().values;
-    auto assembly = GetAssembly();
-    for (auto& str: assembly) {
-        block.push_back(str);
-    }
+    GetIRValues().assembly.push_back(GetAssembly());
     m_functionDepth -= 1;
-    m_currentGlobal = "?";
+    m_currentGlobal = Symbols::NONE;
 }
 
 void IRGenerator::GenDecl()
 {
-    const Token& next = Next();
+    Token next = Next();
 
     if (next.type == TokenType::OPENPAREN) {
         if (m_functionDepth) {
             GenCall();
             ExpectSemicolon();
-            GetIRValues().values.pop_back(); // pop LOAD_RETURNED
+            // pop LOAD_RETURNED, a broken nested definition may have left nothing to pop
+            auto& values = GetIRValues().values;
+            if (!values.empty() && values.back().type == IRType::LOAD_RETURNED) {
+                values.pop_back();
+            }
             return;
         }
         GenFunction();
@@ -564,7 +593,7 @@ void IRGenerator::GenDecl()
     } else if (next.type == TokenType::ASM) {
         GenAsmFunction();
     } else if (next.type == TokenType::COLON) {
-        Emit({IRType::PUT_LABEL, Eat().value});
+        Emit(IRType::PUT_LABEL, 0, SymbolOf(Eat()));
         Advance();
     } else {
         Advance();
@@ -587,12 +616,12 @@ void IRGenerator::GenExtrn()
     Advance();
     Token t = Expect(TokenType::IDENT, "expected identifier when externing");
 
-    m_irInfo.references.insert(t.value);
+    m_irInfo.references.insert(SymbolOf(t));
 
     while (Type() == TokenType::COMMA) {
         Expect(TokenType::COMMA, "expected ',' when seperating externed");
         t = Expect(TokenType::IDENT, "expected identifier when externing");
-        m_irInfo.references.insert(t.value);
+        m_irInfo.references.insert(SymbolOf(t));
     }
     ExpectSemicolon();
 }
@@ -605,22 +634,27 @@ void IRGenerator::GenAuto()
         return;
     }
     Token t = Expect(TokenType::IDENT, "expected identifier when declaring auto");
-    PushLocal(t.value);
+    PushLocal(SymbolOf(t));
     size_t i = 1;
     while (Type() == TokenType::COMMA) {
         Advance();
         t = Expect(TokenType::IDENT, "expected identifier when declaring auto");
-        PushLocal(t.value);
+        PushLocal(SymbolOf(t));
         i += 1;
     }
-    Emit({IRType::RESERVE_STACK, std::to_string(i)});
+    Emit(IRType::RESERVE_STACK, i);
     ExpectSemicolon();
 }
 
 void IRGenerator::GenAsm()
 {
     Advance();
-    Emit({IRType::INLINE_ASM, GetAssembly()});
+    auto assembly = GetAssembly();
+    if (m_currentGlobal == Symbols::NONE)
+        return;
+    auto& values = GetIRValues();
+    Emit(IRType::INLINE_ASM, values.assembly.size());
+    values.assembly.push_back(std::move(assembly));
 }
 
 void IRGenerator::GenReturn()
@@ -654,7 +688,7 @@ void IRGenerator::GenWhile()
 void IRGenerator::GenGoto()
 {
     Advance();
-    Emit({IRType::GOTO_LABEL, Eat().value});
+    Emit(IRType::GOTO_LABEL, 0, SymbolOf(Eat()));
     ExpectSemicolon();
 }
 
@@ -677,7 +711,7 @@ std::vector<std::string> IRGenerator::GetAssembly()
     std::vector<std::string> assembly;
     Expect(TokenType::OPENBRACE, "expected '{' when starting assembly block");
     while (Type() != TokenType::CLOSEBRACE && Type() != TokenType::END_OF_FILE) {
-        assembly.push_back(Expect(TokenType::STRING, "expected string literal in assembly block").value);
+        assembly.push_back(Value(Expect(TokenType::STRING, "expected string literal in assembly block")));
     }
     Expect(TokenType::CLOSEBRACE, "expected '}' when closing assembly block");
     return assembly;
@@ -723,9 +757,10 @@ void IRGenerator::GenStmt()
 // Error Stuff
 void IRGenerator::Error(const std::string& message) 
 {
-    Token& t = m_tokenIndex == 0 ? At() : Next(-1);
+    bool first = m_tokens.Position() == 0;
+    size_t line = first && m_previousLine ? m_previousLine : (first ? At() : Next(-1)).line;
     m_gotError = true;
-    m_errors << "[SYNTAX ERROR]: " << m_sourceName << ':' << t.line << ": " << m_currentGlobal << ": " << message << '\n';
+    m_errors << "[SYNTAX ERROR]: " << m_sourceName << ':' << line << ": " << Symbols::Name(m_currentGlobal) << ": " << message << '\n';
 }
 
 bool IRGenerator::PrintErrors()
@@ -735,28 +770,64 @@ bool IRGenerator::PrintErrors()
     return m_gotError;
 }
 
+bool IRGenerator::HasErrors() const
+{
+    return m_gotError;
+}
+
+std::string IRGenerator::ErrorText() const
+{
+    return m_gotError ? m_errors.str() : std::string();
+}
+
+const std::vector<Symbol>& IRGenerator::Redefined() const
+{
+    return m_redefined;
+}
+
+size_t IRGenerator::TokensRead() const
+{
+    return m_tokens.Lexed();
+}
+
 void IRGenerator::SetSourceName(const std::string& name)
 {
     m_sourceName = name;
 }
 
 // Main
-IRInfo IRGenerator::Generate(const std::vector<Token>& tokens)
+IRInfo IRGenerator::Generate(std::string_view source, size_t line)
 {
-    m_tokens = tokens;
-    m_tokenIndex = 0;
+    m_source = source;
     m_errors.clear();
     m_gotError = false;
-    m_currentGlobal = "?";
-    m_params.clear();
+    if (!m_tokens.Open(source, line)) {
+        m_gotError = true;
+        m_errors << "[FATAL ERROR]: " << m_sourceName << ": source file is larger than 4 GiB\n";
+    }
+    m_redefined.clear();
+    m_currentGlobal = Symbols::NONE;
     m_locals.clear();
-    m_localsSizeStack.clear();
+    m_localsUndo.clear();
+    m_blocks.clear();
     m_localsSize = 1;
     m_functionDepth = 0;
+    m_irInfo.sourceName = m_sourceName;
 
-    while (Type() != TokenType::END_OF_FILE) {
+    while (Type() != TokenType::END_OF_FILE && At().offset < m_end) {
         GenStmt();
     }
 
     return std::move(m_irInfo);
+}
+
+// Continues an IRInfo generated from earlier source, names resolve as if this source had followed it in one file
+void IRGenerator::GenerateInto(IRInfo& irInfo, std::string_view source, size_t line, size_t previousLine, size_t end)
+{
+    m_irInfo = std::move(irInfo);
+    m_previousLine = previousLine;
+    m_end = end;
+    irInfo = Generate(source, line);
+    m_previousLine = 0;
+    m_end = SIZE_MAX;
 }
\ No newline at end of file
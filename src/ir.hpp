@@ -3,12 +3,12 @@
 
 #include "lexer.hpp"
 
-#include <variant>
+#include <unordered_map>
 #include <sstream>
 #include <optional>
 #include <unordered_set>
 
-enum class IRType
+enum class IRType : uint8_t
 {
     LOAD_NUMBER,
     LOAD_FROMBASE,
@@ -60,73 +60,95 @@ enum class IRValuesType
     VARIABLE
 };
 
-using IRValue  = std::variant<IRType, std::string, std::vector<std::string>>;
-using IRLocalInfo = std::unordered_map<std::string, size_t>;
+// Operands an opcode doesn't use are left zero
+struct IRInstruction
+{
+    IRType type;
+    int32_t operand; // number, base offset, argument or slot count, assembly index
+    Symbol symbol;   // global, label or string literal
+};
+
+static_assert(sizeof(IRInstruction) == 12, "instructions are meant to stay compact");
 
 struct IRValues
 {
     IRValuesType type;
-    std::vector<IRValue> values;
-};
-
-enum {
-    IR_TYPE,
-    IR_STRING,
-    IR_STRINGLIST
+    std::vector<IRInstruction> values;
+    std::vector<std::vector<std::string>> assembly; // INLINE_ASM blocks, or the body of an ASM_FUNCTION
+    uint32_t line = 0; // where the definition starts
+    // (first instruction, source line) every time the line changes, for optimization remarks
+    std::vector<std::pair<uint32_t, uint32_t>> lines;
 };
 
 struct IRGlobalInfo
 {
     IRValues irValues;
-    std::unordered_set<std::string> references;
+    SymbolSet references;
 };
 
+// The sets keep source order, the linker and compiler emit in that order
 struct IRInfo
 {
-    std::unordered_map<std::string, IRGlobalInfo> globalsMap;
-    std::unordered_set<std::string> globals;
-    std::unordered_set<std::string> references;
-    std::unordered_set<std::string> strings;
+    std::unordered_map<Symbol, IRGlobalInfo> globalsMap;
+    SymbolSet globals;
+    SymbolSet references;
+    SymbolSet strings;
+    std::string sourceName;
 };
 
 class IRGenerator
 {
 public:
-    IRInfo Generate(const std::vector<Token>& tokens);
+    IRInfo Generate(std::string_view source, size_t line = 1);
+    // Generates only the statements starting before `end` but lets them read on past it, so a statement
+    // that runs into the next one fails the way it would in the whole file. `previousLine` is where the
+    // token before `source` ends, an error at its very first token points there like a full Generate would
+    void GenerateInto(IRInfo& irInfo, std::string_view source, size_t line = 1, size_t previousLine = 0, size_t end = SIZE_MAX);
     bool PrintErrors();
+    bool HasErrors() const;
+    std::string ErrorText() const;
+    // globals the last Generate defined again, replacing the entry an earlier definition made
+    const std::vector<Symbol>& Redefined() const;
+    size_t TokensRead() const;
     void SetSourceName(const std::string& name);
 
 private:
     // IR Info
     IRInfo m_irInfo;
-    std::vector<Token> m_tokens;
-    size_t m_tokenIndex;
+    TokenStream m_tokens;
+    std::string_view m_source;
     std::stringstream m_errors;
-    bool m_gotError;
+    bool m_gotError = false;
+    std::vector<Symbol> m_redefined;
     std::string m_sourceName;
-    std::string m_currentGlobal;
-    std::unordered_map<std::string, int> m_params;
-    std::vector<IRLocalInfo> m_locals;
-    std::vector<size_t> m_localsSizeStack;
+    Symbol m_currentGlobal;
+    size_t m_previousLine = 0;
+    size_t m_end = SIZE_MAX;
+
+    // Locals, one flat table of base offsets, blocks restore shadowed entries from the undo log
+    std::unordered_map<Symbol, int> m_locals;
+    std::vector<std::pair<Symbol, std::optional<int>>> m_localsUndo;
+    std::vector<std::pair<size_t, size_t>> m_blocks;
     size_t m_localsSize;
     size_t m_functionDepth;
     size_t m_localTotal;
 
     // Source Functions
-    Token& At();
-    Token& Eat();
+    Token At();
+    Token Eat();
     TokenType Type();
     void Advance();
-    Token& Expect(TokenType type, const std::string& messsage);
-    Token& Next(int i = 1);
+    Token Expect(TokenType type, const std::string& messsage);
+    Token Next(int i = 1);
+    std::string Value(const Token& token);
+    Symbol SymbolOf(const Token& token);
     IRType EatOperand();
     void ExpectSemicolon();
     void SkipSemicolons();
 
     // Emit Functions
-    void AddGlobal(const std::string& global, IRValuesType type);
-    void Emit(std::initializer_list<IRValue> value);
-    void Emit(const IRValue& value);
+    void AddGlobal(Symbol global, IRValuesType type);
+    void Emit(IRType type, int32_t operand = 0, Symbol symbol = Symbols::NONE);
 
     // Character Parsers
     unsigned char ParseEscape(const std::string& string, size_t& i);
@@ -139,16 +161,17 @@ private:
     std::vector<std::string> GetAssembly();
 
     // IR Stack Related
-    std::optional<int> GetLocal(const std::string& name, bool autoExtern = true);
-    void PushLocal(const std::string& name);
+    std::optional<int> GetLocal(Symbol name, bool autoExtern = true);
+    void SetLocal(Symbol name, int offset);
+    void PushLocal(Symbol name);
     void PushBlock();
     void PopBlock();
 
     // IR Getters
     IRValues& GetIRValues();
-    IRValues& GetIRValues(const std::string& global);
+    IRValues& GetIRValues(Symbol global);
     IRGlobalInfo& GetIRGlobal();
-    IRGlobalInfo& GetIRGlobal(const std::string& global);
+    IRGlobalInfo& GetIRGlobal(Symbol global);
 
     // IR Expr Functions
     void GenPrimary();
@@ -0,0 +1,82 @@
+#include "ir_cache.hpp"
+#include "serializer.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Bump whenever the IR or its encoding changes, stale entries are then ignored
+static constexpr uint64_t CACHE_MAGIC = 0x3152494343434200ULL; // "\0BCCCIR1"
+static constexpr uint64_t CACHE_VERSION = 6;
+
+IRCache::IRCache(const std::string& directory)
+{
+    m_directory = directory;
+}
+
+// the IR records absolute lines, so the same text starting on another line is another entry
+std::string IRCache::EntryPath(std::string_view source, size_t line) const
+{
+    char name[32];
+    uint64_t hash = Serializer::Hash(source) ^ ((uint64_t)line * 0x9e3779b97f4a7c15ULL);
+    snprintf(name, sizeof(name), "%016llx.bir", (unsigned long long)hash);
+    return (fs::path(m_directory) / name).string();
+}
+
+bool IRCache::Load(std::string_view source, IRInfo& irInfo, size_t line) const
+{
+    std::ifstream file(EntryPath(source, line), std::ios::binary);
+    if (!file)
+        return false;
+
+    uint64_t magic, version, size, first;
+    if (!Serializer::ReadU64(file, magic) || magic != CACHE_MAGIC)
+        return false;
+    if (!Serializer::ReadU64(file, version) || version != CACHE_VERSION)
+        return false;
+    // guards against hash collisions between sources of different lengths or lines
+    if (!Serializer::ReadU64(file, size) || size != source.size())
+        return false;
+    if (!Serializer::ReadU64(file, first) || first != line)
+        return false;
+
+    IRInfo cached;
+    if (!Serializer::ReadIRInfo(file, cached))
+        return false;
+    irInfo = std::move(cached);
+    return true;
+}
+
+void IRCache::Store(std::string_view source, const IRInfo& irInfo, size_t line) const
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error)
+        return;
+
+    // write to a unique temporary first so concurrent compilers never see a partial entry
+    std::string path = EntryPath(source, line);
+    std::string temporary = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file)
+            return;
+        Serializer::WriteU64(file, CACHE_MAGIC);
+        Serializer::WriteU64(file, CACHE_VERSION);
+        Serializer::WriteU64(file, source.size());
+        Serializer::WriteU64(file, line);
+        Serializer::WriteIRInfo(file, irInfo);
+        if (!file) {
+            file.close();
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+    fs::rename(temporary, path, error);
+    if (error) {
+        fs::remove(temporary, error);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "ir.hpp"
+
+// On-disk cache of library IR, keyed by a hash of each source file's contents, or of a single
+// definition's text and the line it starts on when the library is loaded lazily
+class IRCache
+{
+public:
+    explicit IRCache(const std::string& directory);
+
+    bool Load(std::string_view source, IRInfo& irInfo, size_t line = 1) const;
+    void Store(std::string_view source, const IRInfo& irInfo, size_t line = 1) const;
+
+private:
+    std::string m_directory;
+
+    std::string EntryPath(std::string_view source, size_t line) const;
+};
@@ -0,0 +1,96 @@
+#include "ir_passes.hpp"
+
+// URCL words are unsigned, comparisons are unsigned and set every bit when true
+static constexpr uint16_t TRUE_WORD = 0xFFFF;
+
+static bool IsBinary(IRType type)
+{
+    switch (type) {
+        case IRType::ADD: case IRType::SUB: case IRType::MUL: case IRType::DIV: case IRType::MOD:
+        case IRType::GREATER: case IRType::LESS: case IRType::GE: case IRType::LE: case IRType::EQUAL: case IRType::NEQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// false when the target's result is not defined, division by zero stays for the program to hit
+static bool Fold(IRType type, uint16_t a, uint16_t b, uint16_t& result)
+{
+    switch (type) {
+        case IRType::ADD: result = a + b; break;
+        case IRType::SUB: result = a - b; break;
+        case IRType::MUL: result = (uint32_t)a * b; break;
+        case IRType::DIV: if (b == 0) return false; result = a / b; break;
+        case IRType::MOD: if (b == 0) return false; result = a % b; break;
+        case IRType::GREATER: result = a > b ? TRUE_WORD : 0; break;
+        case IRType::LESS: result = a < b ? TRUE_WORD : 0; break;
+        case IRType::GE: result = a >= b ? TRUE_WORD : 0; break;
+        case IRType::LE: result = a <= b ? TRUE_WORD : 0; break;
+        case IRType::EQUAL: result = a == b ? TRUE_WORD : 0; break;
+        case IRType::NEQUAL: result = a != b ? TRUE_WORD : 0; break;
+        default: return false;
+    }
+    return true;
+}
+
+static bool IsNumber(const IRInstruction& instruction)
+{
+    return instruction.type == IRType::LOAD_NUMBER;
+}
+
+// Operands are pushed left first, so an operator reads the two instructions right before it.
+// Control flow is structured in the IR, nothing can jump between them
+bool IRPasses::FoldConstants(const IRValues& in, IRValues& out)
+{
+    auto& values = in.values;
+    bool any = false;
+    for (size_t i = 1; i < values.size() && !any; ++i) {
+        any = IsNumber(values[i - 1]) && (values[i].type == IRType::NOT || (i > 1 && IsBinary(values[i].type) && IsNumber(values[i - 2])));
+    }
+    if (!any)
+        return false;
+
+    out.type = in.type;
+    out.line = in.line;
+    out.assembly = in.assembly;
+    out.values.clear();
+    out.lines.clear();
+
+    auto& folded = out.values;
+    size_t line = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        while (line < in.lines.size() && in.lines[line].first <= i) {
+            if (!out.lines.empty() && out.lines.back().first == folded.size()) {
+                out.lines.back().second = in.lines[line].second;
+            } else {
+                out.lines.emplace_back(folded.size(), in.lines[line].second);
+            }
+            line += 1;
+        }
+
+        const IRInstruction& instruction = values[i];
+        size_t count = folded.size();
+        uint16_t result;
+        if (instruction.type == IRType::NOT && count >= 1 && IsNumber(folded[count - 1])) {
+            folded[count - 1].operand = (uint16_t)~(uint16_t)folded[count - 1].operand;
+        } else if (IsBinary(instruction.type) && count >= 2 && IsNumber(folded[count - 2]) && IsNumber(folded[count - 1]) &&
+                   Fold(instruction.type, folded[count - 2].operand, folded[count - 1].operand, result)) {
+            folded.pop_back();
+            folded.back().operand = result;
+        } else {
+            folded.push_back(instruction);
+            continue;
+        }
+
+        // a line that started on a folded operand now starts on the result
+        while (!out.lines.empty() && out.lines.back().first >= folded.size()) {
+            uint32_t lastLine = out.lines.back().second;
+            out.lines.pop_back();
+            if (out.lines.empty() || out.lines.back().first < folded.size() - 1) {
+                out.lines.emplace_back(folded.size() - 1, lastLine);
+            }
+        }
+    }
+    return true;
+}
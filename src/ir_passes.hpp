@@ -0,0 +1,11 @@
+#pragma once
+
+#include "ir.hpp"
+
+// Passes over one function's IR, they write a rewritten copy since linked IR may be shared between programs
+namespace IRPasses
+{
+    // folds operators whose operands are all number literals, the way the 16 bit target would
+    // compute them. Returns false and leaves `out` alone when there is nothing to fold
+    bool FoldConstants(const IRValues& in, IRValues& out);
+}
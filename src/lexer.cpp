@@ -1,6 +1,213 @@
 
 #include "lexer.hpp"
-#include "file.hpp"
+
+#include <array>
+#include <algorithm>
+#include <climits>
+#include <charconv>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_SIMD
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LEXER_SIMD
+#endif
+
+// Character Classes, a table instead of the locale-aware <cctype> calls
+enum : uint8_t
+{
+    CHAR_SPACE = 1,
+    CHAR_IDENT_START = 2,
+    CHAR_IDENT = 4,
+    CHAR_DIGIT = 8,
+    CHAR_HEX = 16,
+};
+
+static constexpr std::array<uint8_t, 256> MakeCharTable()
+{
+    std::array<uint8_t, 256> table = {};
+    table[' '] = table['\r'] = table['\n'] = CHAR_SPACE;
+    table['_'] = CHAR_IDENT_START | CHAR_IDENT;
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] = table[c - 'a' + 'A'] = CHAR_IDENT_START | CHAR_IDENT;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] = CHAR_IDENT | CHAR_DIGIT | CHAR_HEX;
+    }
+    for (int c = 'a'; c <= 'f'; ++c) {
+        table[c] |= CHAR_HEX;
+        table[c - 'a' + 'A'] |= CHAR_HEX;
+    }
+    return table;
+}
+
+static constexpr std::array<uint8_t, 256> g_charTable = MakeCharTable();
+
+static inline bool IsClass(char c, uint8_t charClass)
+{
+    return g_charTable[(unsigned char)c] & charClass;
+}
+
+// Keywords, a perfect hash over the first and last character
+struct Keyword
+{
+    std::string_view name;
+    TokenType type;
+};
+
+static constexpr Keyword g_keywords[] = {
+    {"return", TokenType::RETURN},
+    {"auto", TokenType::AUTO},
+    {"extrn", TokenType::EXTRN},
+    {"else", TokenType::ELSE},
+    {"while", TokenType::WHILE},
+    {"if", TokenType::IF},
+    {"goto", TokenType::GOTO},
+    {"__asm__", TokenType::ASM}
+};
+
+static constexpr size_t KeywordHash(std::string_view ident)
+{
+    return ((unsigned char)ident.front() + 5 * (unsigned char)ident.back()) & 15;
+}
+
+static constexpr std::array<Keyword, 16> MakeKeywordTable()
+{
+    std::array<Keyword, 16> table = {};
+    for (auto& keyword: g_keywords) {
+        table[KeywordHash(keyword.name)] = keyword;
+    }
+    return table;
+}
+
+static constexpr std::array<Keyword, 16> g_keywordTable = MakeKeywordTable();
+
+static constexpr bool KeywordHashIsPerfect()
+{
+    for (auto& keyword: g_keywords) {
+        if (g_keywordTable[KeywordHash(keyword.name)].name != keyword.name)
+            return false;
+    }
+    return true;
+}
+
+static_assert(KeywordHashIsPerfect(), "keyword hash collides, pick new constants for KeywordHash");
+
+// Vector Scanning, each scanner returns the first index at or after i outside its class
+#if defined(__AVX2__)
+using Vec = __m256i;
+static constexpr size_t VEC_SIZE = 32;
+static inline Vec Load(const char* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static inline Vec Splat(char c) { return _mm256_set1_epi8(c); }
+static inline Vec Equal(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Vec Greater(Vec a, Vec b) { return _mm256_cmpgt_epi8(a, b); }
+static inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+static inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline uint32_t MoveMask(Vec v) { return (uint32_t)_mm256_movemask_epi8(v); }
+#elif defined(__SSE2__)
+using Vec = __m128i;
+static constexpr size_t VEC_SIZE = 16;
+static inline Vec Load(const char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline Vec Splat(char c) { return _mm_set1_epi8(c); }
+static inline Vec Equal(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline Vec Greater(Vec a, Vec b) { return _mm_cmpgt_epi8(a, b); }
+static inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline uint32_t MoveMask(Vec v) { return (uint32_t)_mm_movemask_epi8(v); }
+#endif
+
+#ifdef LEXER_SIMD
+static constexpr uint32_t FULL_MASK = VEC_SIZE == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+// bytes are signed here, every class below only holds ASCII so high bytes never match
+static inline Vec InRange(Vec v, char low, char high)
+{
+    return And(Greater(v, Splat(low - 1)), Greater(Splat(high + 1), v));
+}
+
+// Whitespace and identifier runs are usually short and finish in a scalar prologue of this length
+static constexpr size_t SCALAR_PROLOGUE = 16;
+
+template<typename VecClass>
+static inline size_t VectorScan(std::string_view source, size_t i, size_t& line, VecClass inClass)
+{
+    const Vec newline = Splat('\n');
+    while (i + VEC_SIZE <= source.size()) {
+        Vec v = Load(source.data() + i);
+        uint32_t stop = ~MoveMask(inClass(v)) & FULL_MASK;
+        uint32_t newlines = MoveMask(Equal(v, newline));
+        if (stop) {
+            uint32_t before = (1u << __builtin_ctz(stop)) - 1;
+            line += __builtin_popcount(newlines & before);
+            return i + __builtin_ctz(stop);
+        }
+        line += __builtin_popcount(newlines);
+        i += VEC_SIZE;
+    }
+    return i;
+}
+#endif
+
+template<typename ScalarClass>
+static inline size_t ScalarScan(std::string_view source, size_t i, size_t end, size_t& line, ScalarClass inClass)
+{
+    end = std::min(end, source.size());
+    while (i < end && inClass(source[i])) {
+        line += source[i++] == '\n';
+    }
+    return i;
+}
+
+#ifdef LEXER_SIMD
+#define SCAN(source, i, line, prologue, inClass, inVecClass) do { \
+        size_t prologueEnd = i + prologue; \
+        i = ScalarScan(source, i, prologueEnd, line, inClass); \
+        if (i == prologueEnd) \
+            i = VectorScan(source, i, line, inVecClass); \
+        i = ScalarScan(source, i, SIZE_MAX, line, inClass); \
+    } while (0)
+#else
+#define SCAN(source, i, line, prologue, inClass, inVecClass) \
+    i = ScalarScan(source, i, SIZE_MAX, line, inClass)
+#endif
+
+static size_t ScanSpace(std::string_view source, size_t i, size_t& line)
+{
+    SCAN(source, i, line, SCALAR_PROLOGUE, [](char c) { return IsClass(c, CHAR_SPACE); }, [](Vec v) {
+        return Or(Or(Equal(v, Splat(' ')), Equal(v, Splat('\n'))), Equal(v, Splat('\r')));
+    });
+    return i;
+}
+
+static size_t ScanIdent(std::string_view source, size_t i)
+{
+    size_t line = 0;
+    SCAN(source, i, line, SCALAR_PROLOGUE, [](char c) { return IsClass(c, CHAR_IDENT); }, [](Vec v) {
+        Vec lower = Or(v, Splat(0x20));
+        return Or(Or(InRange(lower, 'a', 'z'), InRange(v, '0', '9')), Equal(v, Splat('_')));
+    });
+    return i;
+}
+
+// stops at the closing quote or at a '\0' byte
+static size_t ScanStringBody(std::string_view source, size_t i, size_t& line, char quote)
+{
+    SCAN(source, i, line, 0, [quote](char c) { return c != quote && c != '\0'; }, [quote](Vec v) {
+        Vec stop = Or(Equal(v, Splat(quote)), Equal(v, Splat('\0')));
+        return Equal(stop, Splat(0));
+    });
+    return i;
+}
+
+// stops at the next '*', the caller checks whether a '/' follows
+static size_t ScanToStar(std::string_view source, size_t i, size_t& line)
+{
+    SCAN(source, i, line, 0, [](char c) { return c != '*'; }, [](Vec v) {
+        return Equal(Equal(v, Splat('*')), Splat(0));
+    });
+    return i;
+}
 
 // Source Functions
 void Lexer::Advance()
@@ -13,7 +220,7 @@ void Lexer::Advance()
 
 char Lexer::At() const
 {
-    return m_source[m_sourceIndex];
+    return m_sourceIndex < m_source.size() ? m_source[m_sourceIndex] : '\0';
 }
 
 char Lexer::Eat()
@@ -25,7 +232,8 @@ char Lexer::Eat()
 
 char Lexer::Next(int i) 
 {
-    return m_source[m_sourceIndex + i];
+    size_t index = m_sourceIndex + i;
+    return index < m_source.size() ? m_source[index] : '\0';
 }
 
 bool Lexer::NotEnd()
@@ -33,10 +241,18 @@ bool Lexer::NotEnd()
     return m_sourceIndex < m_source.size();
 }
 
+// Scanning Functions
+void Lexer::SkipWhitespace()
+{
+    m_sourceIndex = ScanSpace(m_source, m_sourceIndex, m_line);
+}
+
 // Push Function
-void Lexer::PushToken(TokenType type, const std::string& value)
+void Lexer::PushToken(TokenType type, Symbol symbol)
 {
-    m_tokens.emplace_back(Token{type, value, m_line});
+    uint32_t line = (uint32_t)std::min(m_line, (size_t)MAX_TOKEN_LINE);
+    m_token = {(uint32_t)m_tokenStart, (uint32_t)(m_sourceIndex - m_tokenStart), line, type, symbol};
+    m_hasToken = true;
 }
 
 // Lexer Functions
@@ -45,80 +261,59 @@ void Lexer::LexString()
     char quote = Eat();
     TokenType type = quote == '\'' ? TokenType::CHAR : TokenType::STRING;
 
-    std::string data;
-    char c;
-
-    while ((c = At()) != quote && c != '\0') {
-        data += Eat();
-    }
+    m_sourceIndex = ScanStringBody(m_source, m_sourceIndex, m_line, quote);
     if (Eat() == '\0') {
-        PushToken(TokenType::INVALID, "end of file");
+        PushToken(TokenType::UNTERMINATED_STRING);
         return;
     }
-    PushToken(type, data);
+    PushToken(type);
 }
 
-#include <sstream>
-
 void Lexer::LexNumber()
 {
-    std::string raw;
-    int value = 0;
-
     if (At() == '0' && (Next() == 'x' || Next() == 'X')) {
         Advance(); 
         Advance(); 
 
-        while (isxdigit(At())) {
-            raw += Eat();
+        while (IsClass(At(), CHAR_HEX)) {
+            Advance();
         }
-
-        std::stringstream ss;
-        ss << std::hex << raw;
-        ss >> value;
-
-        PushToken(TokenType::NUMBER, std::to_string(value));
+        PushToken(TokenType::NUMBER);
         return;
     }
 
-    while (isdigit(At())) {
-        raw += Eat();
+    while (IsClass(At(), CHAR_DIGIT)) {
+        Advance();
     }
-
-    PushToken(TokenType::NUMBER, raw);
+    PushToken(TokenType::NUMBER);
 }
 
-
 void Lexer::LexIdent()
 {
-    TokenType type = TokenType::IDENT;
-    std::string ident(1, Eat());
-    char c;
+    m_sourceIndex = ScanIdent(m_source, m_sourceIndex + 1);
 
-    while (isalpha(c = At()) || isdigit(c) || c == '_') {
-        ident += Eat();
+    std::string_view ident = m_source.substr(m_tokenStart, m_sourceIndex - m_tokenStart);
+    const Keyword& keyword = g_keywordTable[KeywordHash(ident)];
+    if (keyword.name == ident) {
+        PushToken(keyword.type);
+        return;
     }
-
-    if (_identRecord.find(ident) != _identRecord.end()) 
-        type = _identRecord[ident];
-    
-    PushToken(type, ident);
+    PushToken(TokenType::IDENT, Symbols::Intern(ident));
 }
 
 // Reserved for Lexer::LexOperand()
 #define CaseOperand(operandChar, tokenType) \
-    case operandChar: PushToken(tokenType, operand); return;
+    case operandChar: PushToken(tokenType); return;
 
 #define WhenOperandAt(operandChar, tokenType) \
     if (At() == operandChar) { \
-        operand += Eat(); \
-        PushToken(tokenType, operand); \
+        Advance(); \
+        PushToken(tokenType); \
     } else
 
 void Lexer::LexOperand()
 {
     char c = Eat();
-    std::string operand(1, c);
 
     switch (c) {
         CaseOperand('+', TokenType::PLUS);
@@ -137,54 +332,66 @@ void Lexer::LexOperand()
         CaseOperand('?', TokenType::QUESTION);
         case '!': {
             WhenOperandAt('=', TokenType::ISNEQUAL)
-            PushToken(TokenType::NOT, operand);
+            PushToken(TokenType::NOT);
             return;
         }
         case '<': {
             WhenOperandAt('=', TokenType::ISLE)
-            PushToken(TokenType::ISLESS, operand);
+            PushToken(TokenType::ISLESS);
             return;
         }
         case '>': {
             WhenOperandAt('=', TokenType::ISGE)
-            PushToken(TokenType::ISGREATER, operand);
+            PushToken(TokenType::ISGREATER);
             return;
         }
         case '=': {
             WhenOperandAt('=', TokenType::ISEQUAL)
-            PushToken(TokenType::EQUAL, operand);
+            PushToken(TokenType::EQUAL);
             return;
         }
     }
-    PushToken(TokenType::INVALID, operand);
+    PushToken(TokenType::INVALID);
 }
 
 void Lexer::LexComment()
 {
     m_sourceIndex += 2;
     while (NotEnd()) {
+        // an unterminated comment ends at the end of the source, not a byte past it
+        m_sourceIndex = std::min(ScanToStar(m_source, m_sourceIndex, m_line), m_source.size());
+        if (!NotEnd())
+            break;
         if (At() == '*' && Next() == '/') {
             m_sourceIndex += 2;
             return; // already finished comment
         }
         Advance();
     }
-    PushToken(TokenType::INVALID, "unterminated comment");
+    PushToken(TokenType::UNTERMINATED_COMMENT);
 }
 
-std::vector<Token> Lexer::Tokenize(const std::string& path) 
+bool Lexer::Open(std::string_view source, size_t line)
 {
-    m_source = File::ReadEverything(path);
-    m_line = 1;
+    bool fits = source.size() <= MAX_SOURCE;
+    m_source = fits ? source : std::string_view();
+    m_line = line;
     m_sourceIndex = 0;
+    return fits;
+}
 
-    while (NotEnd()) {
+Token Lexer::NextToken()
+{
+    m_hasToken = false;
+
+    while (NotEnd() && !m_hasToken) {
         char c = At();
+        m_tokenStart = m_sourceIndex;
         switch (c) {
             case '\r':
             case ' ':
             case '\n':
-                Advance();
+                SkipWhitespace();
                 break;
             case '\'':
             case '"':
@@ -196,11 +403,11 @@ std::vector<Token> Lexer::Tokenize(const std::string& path)
                     break;
                 }
             default: {
-                if (isalpha(c) || c == '_') {
+                if (IsClass(c, CHAR_IDENT_START)) {
                     LexIdent();
                     break;
                 } 
-                if (isdigit(c)) {
+                if (IsClass(c, CHAR_DIGIT)) {
                     LexNumber();
                     break;
                 }
@@ -210,6 +417,87 @@ std::vector<Token> Lexer::Tokenize(const std::string& path)
         }
     }
 
-    PushToken(TokenType::END_OF_FILE, "end of file");
-    return std::move(m_tokens);
+    if (!m_hasToken) {
+        m_tokenStart = m_sourceIndex;
+        PushToken(TokenType::END_OF_FILE);
+    }
+    return m_token;
+}
+
+std::vector<Token> Lexer::Tokenize(std::string_view source, size_t line)
+{
+    std::vector<Token> tokens;
+    Open(source, line);
+    do {
+        tokens.push_back(NextToken());
+    } while (tokens.back().type != TokenType::END_OF_FILE);
+    return tokens;
+}
+
+// Token Stream
+bool TokenStream::Open(std::string_view source, size_t line)
+{
+    m_position = 0;
+    m_lexed = 0;
+    return m_lexer.Open(source, line);
+}
+
+const Token& TokenStream::Peek(int offset)
+{
+    size_t index = m_position + offset;
+    while (m_lexed <= index) {
+        m_window[m_lexed % WINDOW] = m_lexer.NextToken();
+        m_lexed += 1;
+    }
+    return m_window[index % WINDOW];
+}
+
+void TokenStream::Advance()
+{
+    Peek();
+    m_position += 1;
+}
+
+size_t TokenStream::Position() const
+{
+    return m_position;
+}
+
+size_t TokenStream::Lexed() const
+{
+    return m_lexed;
+}
+
+// Token Text Functions
+std::string_view Lexer::Text(const Token& token, std::string_view source)
+{
+    switch (token.type) {
+        case TokenType::END_OF_FILE:
+        case TokenType::UNTERMINATED_STRING:
+            return "end of file";
+        case TokenType::UNTERMINATED_COMMENT:
+            return "unterminated comment";
+        case TokenType::STRING:
+        case TokenType::CHAR:
+            // without the quotes
+            return source.substr(token.offset + 1, token.length - 2);
+        default:
+            return source.substr(token.offset, token.length);
+    }
+}
+
+int Lexer::NumberValue(std::string_view number)
+{
+    int base = 10;
+    if (number.size() >= 2 && number[0] == '0' && (number[1] == 'x' || number[1] == 'X')) {
+        number.remove_prefix(2);
+        base = 16;
+    }
+
+    int value = 0;
+    auto result = std::from_chars(number.data(), number.data() + number.size(), value, base);
+    if (result.ec == std::errc::result_out_of_range) {
+        value = INT_MAX; // what the stream extraction this replaced produced
+    }
+    return value;
 }
\ No newline at end of file
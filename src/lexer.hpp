@@ -1,11 +1,14 @@
 
 #pragma once
 
+#include "symbol.hpp"
+
 #include <vector>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <cstdint>
 
-enum class TokenType
+enum class TokenType : uint8_t
 {
     // Basic Types
     NUMBER,
@@ -13,6 +16,8 @@ enum class TokenType
     IDENT,
     CHAR,
     INVALID,
+    UNTERMINATED_STRING,
+    UNTERMINATED_COMMENT,
     END_OF_FILE,
     // Identifier Record Types
     RETURN,
@@ -49,34 +54,42 @@ enum class TokenType
     ISLE,
 };
 
+// Tokens only point into the source they were lexed from, which must outlive them
 struct Token
 {
-    TokenType type;
-    std::string value;
-    size_t line, col;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t line : 24; // saturates at MAX_TOKEN_LINE
+    TokenType type : 8;
+    Symbol symbol; // identifiers only
 };
 
-static std::unordered_map<std::string, TokenType> _identRecord = {
-    {"return", TokenType::RETURN},
-    {"auto", TokenType::AUTO},
-    {"extrn", TokenType::EXTRN},
-    {"else", TokenType::ELSE},
-    {"while", TokenType::WHILE},
-    {"if", TokenType::IF},
-    {"goto", TokenType::GOTO},
-    {"__asm__", TokenType::ASM}
-};
+constexpr uint32_t MAX_TOKEN_LINE = (1u << 24) - 1;
+
+static_assert(sizeof(Token) == 16, "tokens are meant to stay compact");
 
 class Lexer 
 {
 public:
-    std::vector<Token> Tokenize(const std::string& path);
+    // token offsets are 32 bits, a larger source is refused by Open and lexes as an empty one
+    static constexpr size_t MAX_SOURCE = UINT32_MAX;
+
+    std::vector<Token> Tokenize(std::string_view source, size_t line = 1);
+
+    // Pull Functions
+    bool Open(std::string_view source, size_t line = 1);
+    Token NextToken();
+
+    static std::string_view Text(const Token& token, std::string_view source);
+    static int NumberValue(std::string_view number);
 
 private:
     // Lexer Info
-    std::vector<Token> m_tokens;
-    std::string m_source;
+    Token m_token;
+    bool m_hasToken;
+    std::string_view m_source;
     size_t m_sourceIndex;
+    size_t m_tokenStart;
     size_t m_line;
 
     // Source Functions
@@ -87,7 +100,10 @@ private:
     bool NotEnd();
 
     // Push Function
-    void PushToken(TokenType type, const std::string& value);
+    void PushToken(TokenType type, Symbol symbol = Symbols::NONE);
+
+    // Scanning Functions
+    void SkipWhitespace();
 
     // Lexer Functions
     void LexString();
@@ -95,4 +111,26 @@ private:
     void LexIdent();
     void LexOperand();
     void LexComment();
-};
\ No newline at end of file
+};
+
+// Pulls tokens from a Lexer on demand, keeping only a small window around the current one
+class TokenStream
+{
+public:
+    bool Open(std::string_view source, size_t line = 1);
+
+    // offset may range from -1 (the previous token) up to WINDOW - 2
+    const Token& Peek(int offset = 0);
+    void Advance();
+    size_t Position() const;
+    // tokens lexed since Open, a few may still be waiting in the window
+    size_t Lexed() const;
+
+private:
+    static constexpr size_t WINDOW = 4;
+
+    Lexer m_lexer;
+    Token m_window[WINDOW];
+    size_t m_position;
+    size_t m_lexed;
+};
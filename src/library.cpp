@@ -0,0 +1,346 @@
+#include "library.hpp"
+#include "serializer.hpp"
+#include "file.hpp"
+#include "top_level.hpp"
+
+#include <fstream>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static constexpr uint64_t MANIFEST_MAGIC = 0x3153464e4d434200ULL; // "\0BCMNFS1"
+static constexpr uint64_t MANIFEST_VERSION = 1;
+
+Library::Library(const std::string& directory, const std::string& cacheDirectory)
+{
+    m_directory = directory;
+    m_cacheDirectory = cacheDirectory;
+    m_manifestPath = (fs::path(cacheDirectory) / "manifest.bin").string();
+}
+
+// Manifest Functions
+bool Library::ScanFile(LibraryFile& file)
+{
+    Lexer lexer;
+    File::Mapping mapping;
+    if (!mapping.Open(file.path)) {
+        std::cerr << "[FATAL ERROR]: could not read library file '" << file.path << "'\n";
+        std::cerr << "Compilation Terminated.";
+        return false;
+    }
+    if (mapping.View().size() > Lexer::MAX_SOURCE) {
+        std::cerr << "[FATAL ERROR]: library file '" << file.path << "' is larger than 4 GiB\n";
+        std::cerr << "Compilation Terminated.";
+        return false;
+    }
+    auto tokens = lexer.Tokenize(mapping.View());
+    file.symbols.clear();
+
+    for (auto& item: TopLevel::Split(tokens)) {
+        if (!item.definition)
+            continue;
+        const Token& first = tokens[item.first];
+        const Token& last = tokens[item.last - 1];
+        std::string name(Lexer::Text(first, mapping.View()));
+        file.symbols.push_back({name, first.offset, last.offset + last.length - first.offset, first.line});
+    }
+    return true;
+}
+
+bool Library::ReadManifest(std::unordered_map<std::string, LibraryFile>& cached)
+{
+    std::ifstream stream(m_manifestPath, std::ios::binary);
+    if (!stream)
+        return false;
+
+    uint64_t magic, version, count;
+    if (!Serializer::ReadU64(stream, magic) || magic != MANIFEST_MAGIC)
+        return false;
+    if (!Serializer::ReadU64(stream, version) || version != MANIFEST_VERSION)
+        return false;
+    if (!Serializer::ReadU64(stream, count))
+        return false;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        LibraryFile file;
+        uint64_t modified, symbols;
+        if (!Serializer::ReadString(stream, file.path) ||
+            !Serializer::ReadU64(stream, file.size) ||
+            !Serializer::ReadU64(stream, modified) ||
+            !Serializer::ReadU64(stream, symbols))
+            return false;
+        file.modified = (int64_t)modified;
+
+        for (uint64_t j = 0; j < symbols; ++j) {
+            LibrarySymbol symbol;
+            uint64_t offset, length, line;
+            if (!Serializer::ReadString(stream, symbol.name) ||
+                !Serializer::ReadU64(stream, offset) ||
+                !Serializer::ReadU64(stream, length) ||
+                !Serializer::ReadU64(stream, line))
+                return false;
+            symbol.offset = offset;
+            symbol.length = length;
+            symbol.line = line;
+            file.symbols.push_back(std::move(symbol));
+        }
+        cached[file.path] = std::move(file);
+    }
+    return true;
+}
+
+void Library::WriteManifest()
+{
+    std::error_code error;
+    fs::create_directories(fs::path(m_manifestPath).parent_path(), error);
+    if (error)
+        return;
+
+    std::string temporary = m_manifestPath + "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream stream(temporary, std::ios::binary);
+        if (!stream)
+            return;
+        Serializer::WriteU64(stream, MANIFEST_MAGIC);
+        Serializer::WriteU64(stream, MANIFEST_VERSION);
+        Serializer::WriteU64(stream, m_files.size());
+        for (auto& file: m_files) {
+            Serializer::WriteString(stream, file.path);
+            Serializer::WriteU64(stream, file.size);
+            Serializer::WriteU64(stream, (uint64_t)file.modified);
+            Serializer::WriteU64(stream, file.symbols.size());
+            for (auto& symbol: file.symbols) {
+                Serializer::WriteString(stream, symbol.name);
+                Serializer::WriteU64(stream, symbol.offset);
+                Serializer::WriteU64(stream, symbol.length);
+                Serializer::WriteU64(stream, symbol.line);
+            }
+        }
+        if (!stream) {
+            stream.close();
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+    fs::rename(temporary, m_manifestPath, error);
+    if (error) {
+        fs::remove(temporary, error);
+    }
+}
+
+void Library::BuildIndex()
+{
+    m_index.clear();
+    m_duplicates.clear();
+    for (size_t i = 0; i < m_files.size(); ++i) {
+        auto& symbols = m_files[i].symbols;
+        for (size_t j = 0; j < symbols.size(); ++j) {
+            Symbol name = Symbols::Intern(symbols[j].name);
+            auto result = m_index.emplace(name, std::make_pair(i, j));
+            if (!result.second) {
+                m_duplicates.insert(name);
+            }
+        }
+    }
+}
+
+void Library::Forget()
+{
+    m_files.clear();
+    m_index.clear();
+    m_duplicates.clear();
+    m_loaded.clear();
+    m_scanned = false;
+}
+
+bool Library::Scan()
+{
+    // the first scan trusts the manifest, a later one the previous scan
+    std::unordered_map<std::string, LibraryFile> cached;
+    bool manifestValid = true;
+    bool rescan = m_scanned;
+    if (rescan) {
+        for (auto& file: m_files) {
+            std::string path = file.path;
+            cached[path] = std::move(file);
+        }
+    } else {
+        manifestValid = ReadManifest(cached);
+    }
+    size_t reused = 0;
+    std::unordered_set<std::string> unchanged;
+
+    std::vector<LibraryFile> files;
+    try {
+        for (auto& entry: fs::recursive_directory_iterator(m_directory)) {
+            if (!fs::is_regular_file(entry) || entry.path().extension() != ".b")
+                continue;
+
+            LibraryFile file;
+            file.path = entry.path().string();
+            file.size = entry.file_size();
+            file.modified = (int64_t)entry.last_write_time().time_since_epoch().count();
+
+            auto found = cached.find(file.path);
+            if (found != cached.end() && found->second.size == file.size && found->second.modified == file.modified) {
+                file.symbols = std::move(found->second.symbols);
+                reused += 1;
+                if (rescan) {
+                    unchanged.insert(file.path);
+                }
+            } else if (!ScanFile(file)) {
+                Forget();
+                return false;
+            }
+            files.push_back(std::move(file));
+        }
+    } catch (const fs::filesystem_error& e) {
+        std::cerr << "[FATAL ERROR]: " << e.what() << '\n';
+        std::cerr << "Compilation Terminated.";
+        Forget();
+        return false;
+    }
+
+    // directory iteration order is unspecified, the files are parsed and indexed in path order
+    std::sort(files.begin(), files.end(), [](const LibraryFile& a, const LibraryFile& b) {
+        return a.path < b.path;
+    });
+    m_files = std::move(files);
+
+    if (!manifestValid || reused != m_files.size() || reused != cached.size()) {
+        WriteManifest();
+    }
+    BuildIndex();
+    for (auto loaded = m_loaded.begin(); loaded != m_loaded.end();) {
+        loaded = unchanged.count(loaded->second.path) ? std::next(loaded) : m_loaded.erase(loaded);
+    }
+    m_scanned = true;
+    return true;
+}
+
+bool Library::Scanned() const
+{
+    return m_scanned;
+}
+
+std::vector<std::string> Library::GetFiles() const
+{
+    std::vector<std::string> files;
+    for (auto& file: m_files) {
+        files.push_back(file.path);
+    }
+    return files;
+}
+
+const std::string& Library::GetCacheDirectory() const
+{
+    return m_cacheDirectory;
+}
+
+void Library::SetKeepLoaded(bool enabled)
+{
+    m_keepLoaded = enabled;
+    if (!enabled) {
+        m_loaded.clear();
+    }
+}
+
+// Loader Functions
+bool Library::LoadSymbol(const LibraryFile& file, const LibrarySymbol& symbol, IRInfo& irInfo, const IRCache* cache)
+{
+    // the offsets are only good for the file as it was scanned
+    std::error_code error;
+    uint64_t size = fs::file_size(file.path, error);
+    int64_t modified = 0;
+    if (!error) {
+        modified = (int64_t)fs::last_write_time(file.path, error).time_since_epoch().count();
+    }
+    if (error || size != file.size || modified != file.modified) {
+        std::cerr << "[FATAL ERROR]: library file '" << file.path << "' changed after it was scanned\n";
+        std::cerr << "Compilation Terminated.";
+        return false;
+    }
+
+    std::ifstream stream(file.path, std::ios::binary);
+    std::string source(symbol.length, '\0');
+    if (!stream.seekg(symbol.offset) || !stream.read(source.data(), symbol.length)) {
+        std::cerr << "[FATAL ERROR]: could not read '" << symbol.name << "' from '" << file.path << "'\n";
+        std::cerr << "Compilation Terminated.";
+        return false;
+    }
+
+    // a cached entry may have been stored from a copy of the library somewhere else
+    if (cache && cache->Load(source, irInfo, symbol.line)) {
+        irInfo.sourceName = file.path;
+        return true;
+    }
+
+    IRGenerator irGen;
+    irGen.SetSourceName(file.path);
+    irInfo = irGen.Generate(source, symbol.line);
+    if (irGen.PrintErrors())
+        return false;
+    if (cache) {
+        cache->Store(source, irInfo, symbol.line);
+    }
+    return true;
+}
+
+bool Library::LoadKept(Symbol name, const LibraryFile& file, IRInfo& irInfo)
+{
+    if (!m_keepLoaded)
+        return false;
+    std::lock_guard<std::mutex> lock(m_loadedMutex);
+    auto loaded = m_loaded.find(name);
+    if (loaded == m_loaded.end() || loaded->second.path != file.path)
+        return false;
+    irInfo = loaded->second.irInfo;
+    return true;
+}
+
+bool Library::LoadReferenced(std::vector<IRInfo>& toLink, const IRCache* cache)
+{
+    std::unordered_set<Symbol> defined;
+    std::vector<Symbol> pending = {Symbols::Intern("main")};
+
+    for (auto& irInfo: toLink) {
+        defined.insert(irInfo.globals.begin(), irInfo.globals.end());
+        pending.insert(pending.end(), irInfo.references.begin(), irInfo.references.end());
+    }
+
+    // Pull in library definitions for every undefined reference, transitively
+    while (!pending.empty()) {
+        Symbol name = pending.back();
+        pending.pop_back();
+
+        if (defined.count(name))
+            continue;
+        auto found = m_index.find(name);
+        if (found == m_index.end())
+            continue; // left for the linker to report
+        if (m_duplicates.count(name)) {
+            std::cerr << "[LINKER ERROR]: multiple definitions of symbol: '" << Symbols::Name(name) << "'\n";
+            return false;
+        }
+
+        IRInfo irInfo;
+        auto& file = m_files[found->second.first];
+        if (!LoadKept(name, file, irInfo)) {
+            if (!LoadSymbol(file, file.symbols[found->second.second], irInfo, cache))
+                return false;
+            if (m_keepLoaded) {
+                std::lock_guard<std::mutex> lock(m_loadedMutex);
+                m_loaded[name] = {file.path, irInfo};
+            }
+        }
+
+        defined.insert(name);
+        defined.insert(irInfo.globals.begin(), irInfo.globals.end());
+        pending.insert(pending.end(), irInfo.references.begin(), irInfo.references.end());
+        toLink.push_back(std::move(irInfo));
+    }
+    return true;
+}
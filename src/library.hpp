@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ir.hpp"
+#include "ir_cache.hpp"
+
+#include <cstdint>
+#include <mutex>
+
+// A top-level definition inside a library file
+struct LibrarySymbol
+{
+    std::string name;
+    size_t offset, length, line;
+};
+
+struct LibraryFile
+{
+    std::string path;
+    uint64_t size;
+    int64_t modified;
+    std::vector<LibrarySymbol> symbols;
+};
+
+// A definition LoadReferenced already parsed, kept with the file it came from
+struct LoadedSymbol
+{
+    std::string path;
+    IRInfo irInfo;
+};
+
+// Symbol manifest of the library directory, lets the driver parse only the definitions a program reaches
+class Library
+{
+public:
+    Library(const std::string& directory, const std::string& cacheDirectory);
+
+    // a later Scan only rescans the files that changed since the last one and forgets what was loaded from them
+    bool Scan();
+    bool Scanned() const;
+    std::vector<std::string> GetFiles() const;
+    const std::string& GetCacheDirectory() const;
+    // parses every definition the program reaches, through `cache` when one is given
+    bool LoadReferenced(std::vector<IRInfo>& toLink, const IRCache* cache = nullptr);
+    // keeps every definition parsed by LoadReferenced for later calls, used by the compile server and
+    // batch mode, once scanned LoadReferenced may then run on several threads at once
+    void SetKeepLoaded(bool enabled);
+
+private:
+    // Library Info
+    std::string m_directory;
+    std::string m_cacheDirectory;
+    std::string m_manifestPath;
+    bool m_scanned = false;
+    bool m_keepLoaded = false;
+    std::unordered_map<Symbol, LoadedSymbol> m_loaded;
+    std::mutex m_loadedMutex;
+    std::vector<LibraryFile> m_files;
+    std::unordered_map<Symbol, std::pair<size_t, size_t>> m_index;
+    std::unordered_set<Symbol> m_duplicates;
+
+    // Manifest Functions
+    bool ReadManifest(std::unordered_map<std::string, LibraryFile>& cached);
+    void WriteManifest();
+    bool ScanFile(LibraryFile& file);
+    void BuildIndex();
+    void Forget();
+
+    // Loader Functions
+    bool LoadSymbol(const LibraryFile& file, const LibrarySymbol& symbol, IRInfo& irInfo, const IRCache* cache);
+    bool LoadKept(Symbol name, const LibraryFile& file, IRInfo& irInfo);
+};
@@ -0,0 +1,433 @@
+#include "machine_ir.hpp"
+
+#include <charconv>
+
+static constexpr uint32_t NO_LABEL = UINT32_MAX;
+
+static const char* g_opcodeNames[] = {
+    "add", "sub", "mlt", "div", "mod", "not", "inc", "dec",
+    "setl", "setg", "setge", "setle", "sete", "setne",
+    "brg", "ble", "bre", "bge", "brl", "bne", "brz", "bnz", "jmp",
+    "imm", "mov", "lod", "str", "llod", "lstr", "psh", "pop",
+    "cal", "ret", "hlt", "in", "out", "nop", "raw"
+};
+
+static_assert(sizeof(g_opcodeNames) / sizeof(g_opcodeNames[0]) == (size_t)Opcode::RAW + 1, "every opcode needs a name");
+
+static bool ParseInteger(std::string_view text, int32_t& value)
+{
+    // only the canonical spelling, anything else must print back exactly as written
+    std::string_view digits = (!text.empty() && text[0] == '-') ? text.substr(1) : text;
+    if (digits.empty() || (digits[0] == '0' && (digits.size() > 1 || text[0] == '-')))
+        return false;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+MachineInstruction MakeInstruction(Opcode opcode, Operand a, Operand b, Operand c)
+{
+    MachineInstruction instruction = {opcode, 0, {a, b, c}, Symbols::NONE};
+    while (instruction.count < 3 && instruction.ops[instruction.count].kind != OperandKind::NONE) {
+        instruction.count += 1;
+    }
+    return instruction;
+}
+
+MachineProgram::MachineProgram()
+{
+    m_anonymousLabels = 0;
+    m_labelBase = 0;
+    m_line = 0;
+    m_blockEnded = true;
+}
+
+void MachineProgram::Reset()
+{
+    m_blocks.clear();
+    m_arena.Reset();
+    m_labels.clear();
+    m_namedLabels.clear();
+    m_shownLabel.clear();
+    m_labelPosition.clear();
+    m_anonymousLabels = 0;
+    m_line = 0;
+    m_blockEnded = true;
+}
+
+// Label Functions
+uint32_t MachineProgram::NewLabel()
+{
+    m_labels.push_back({Symbols::NONE, m_anonymousLabels++, (uint32_t)m_labels.size(), false, false});
+    return m_labels.size() - 1;
+}
+
+uint32_t MachineProgram::NamedLabel(Symbol name)
+{
+    auto result = m_namedLabels.emplace(name, m_labels.size());
+    if (result.second) {
+        m_labels.push_back({name, 0, (uint32_t)m_labels.size(), false, false});
+    }
+    return result.first->second;
+}
+
+uint32_t MachineProgram::RelativeLabel()
+{
+    m_labels.push_back({Symbols::NONE, 0, (uint32_t)m_labels.size(), true, false});
+    return m_labels.size() - 1;
+}
+
+void MachineProgram::PlaceLabel(uint32_t label)
+{
+    // labels placed back to back share a block
+    if (m_blocks.empty() || !m_blocks.back().instructions.empty()) {
+        m_blocks.emplace_back(&m_arena);
+    }
+    m_blocks.back().labels.push_back(label);
+    m_blockEnded = false;
+}
+
+uint32_t MachineProgram::FindLabel(uint32_t label)
+{
+    while (m_labels[label].parent != label) {
+        m_labels[label].parent = m_labels[m_labels[label].parent].parent;
+        label = m_labels[label].parent;
+    }
+    return label;
+}
+
+void MachineProgram::MergeLabels(uint32_t label, uint32_t alias)
+{
+    uint32_t root = FindLabel(label);
+    uint32_t other = FindLabel(alias);
+    if (root != other) {
+        m_labels[other].parent = root;
+    }
+}
+
+void MachineProgram::ExportLabel(uint32_t label)
+{
+    m_labels[label].exported = true;
+}
+
+uint32_t MachineProgram::AnonymousLabels() const
+{
+    return m_anonymousLabels;
+}
+
+// Emit Functions
+void MachineProgram::Emit(Opcode opcode, Operand a, Operand b, Operand c)
+{
+    if (m_blockEnded) {
+        m_blocks.emplace_back(&m_arena);
+        m_blockEnded = false;
+    }
+
+    m_blocks.back().instructions.push_back(MakeInstruction(opcode, a, b, c));
+    m_blocks.back().instructions.back().line = m_line;
+    m_blockEnded = IsTerminator(opcode);
+}
+
+void MachineProgram::SetLine(uint32_t line)
+{
+    m_line = line;
+}
+
+uint32_t MachineProgram::Line() const
+{
+    return m_line;
+}
+
+// Assembly Functions
+Operand MachineProgram::ParseOperand(std::string_view word)
+{
+    int32_t value;
+    if (word.size() > 1 && word[0] == 'r' && ParseInteger(word.substr(1), value) && value >= 0)
+        return Operand::Register(value);
+    if (ParseInteger(word, value))
+        return Operand::Immediate(value);
+    if (word.size() > 1 && word[0] == '.')
+        return Operand::Label(NamedLabel(Symbols::Intern(word.substr(1))));
+    return Operand::Named(Symbols::Intern(word));
+}
+
+bool MachineProgram::ParseRelative(std::string_view word, int32_t& offset)
+{
+    if (word.size() < 2 || word[0] != '~')
+        return false;
+    if (word[1] == '+') {
+        word.remove_prefix(2);
+        return !word.empty() && word[0] != '-' && ParseInteger(word, offset);
+    }
+    word.remove_prefix(1);
+    return ParseInteger(word, offset);
+}
+
+static bool IsCommentLine(std::string_view word)
+{
+    return word.substr(0, 2) == "//" || word[0] == '@';
+}
+
+// Relative jumps count instructions, so each ~+N/~-N that lands inside the block (or just after it)
+// becomes a synthetic label placed at its target, the optimizer can then delete instructions freely
+void MachineProgram::EmitAssembly(const std::vector<std::string>& lines)
+{
+    std::vector<std::vector<std::string_view>> lineWords(lines.size());
+    size_t count = 0;
+    for (size_t line = 0; line < lines.size(); ++line) {
+        std::string_view text = lines[line];
+        auto& words = lineWords[line];
+        size_t i = 0;
+        while (i < text.size()) {
+            if (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n') {
+                i += 1;
+                continue;
+            }
+            size_t start = i;
+            while (i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != '\r' && text[i] != '\n') {
+                i += 1;
+            }
+            words.push_back(text.substr(start, i - start));
+        }
+        if (!words.empty() && words[0][0] != '.' && !IsCommentLine(words[0])) {
+            count += 1;
+        }
+    }
+
+    std::vector<uint32_t> targets(count + 1, NO_LABEL);
+    size_t position = 0;
+    for (auto& words: lineWords) {
+        if (words.empty() || words[0][0] == '.' || IsCommentLine(words[0]))
+            continue;
+        for (size_t word = 1; word < words.size() && words.size() <= 4; ++word) {
+            int32_t offset;
+            if (!ParseRelative(words[word], offset))
+                continue;
+            int64_t target = (int64_t)position + offset;
+            if (target >= 0 && target <= (int64_t)count && targets[target] == NO_LABEL) {
+                targets[target] = RelativeLabel();
+            }
+        }
+        position += 1;
+    }
+
+    position = 0;
+    for (auto& words: lineWords) {
+        if (words.empty())
+            continue;
+
+        if (words[0][0] == '.') {
+            uint32_t label = NamedLabel(Symbols::Intern(words[0].substr(1)));
+            PlaceLabel(label);
+            ExportLabel(label);
+            continue;
+        }
+
+        bool comment = IsCommentLine(words[0]);
+        if (!comment && targets[position] != NO_LABEL) {
+            PlaceLabel(targets[position]);
+        }
+
+        Opcode opcode = Opcode::RAW;
+        for (size_t op = 0; op < (size_t)Opcode::RAW; ++op) {
+            if (words[0] == g_opcodeNames[op]) {
+                opcode = (Opcode)op;
+                break;
+            }
+        }
+
+        if (comment || words.size() > 4) {
+            std::string text(words[0]);
+            for (size_t word = 1; word < words.size(); ++word) {
+                text += ' ';
+                text += words[word];
+            }
+            Emit(Opcode::RAW);
+            m_blocks.back().instructions.back().text = Symbols::Intern(text);
+        } else {
+            Operand ops[3];
+            for (size_t word = 1; word < words.size(); ++word) {
+                int32_t offset;
+                int64_t target = ParseRelative(words[word], offset) ? (int64_t)position + offset : -1;
+                if (target >= 0 && target <= (int64_t)count) {
+                    ops[word - 1] = Operand::Label(targets[target]);
+                } else {
+                    ops[word - 1] = ParseOperand(words[word]);
+                }
+            }
+            Emit(opcode, ops[0], ops[1], ops[2]);
+            if (opcode == Opcode::RAW) {
+                m_blocks.back().instructions.back().text = Symbols::Intern(words[0]);
+            }
+        }
+
+        if (!comment) {
+            position += 1;
+        }
+    }
+
+    if (targets[count] != NO_LABEL) {
+        PlaceLabel(targets[count]);
+    }
+}
+
+std::vector<BasicBlock>& MachineProgram::Blocks()
+{
+    return m_blocks;
+}
+
+const char* MachineProgram::OpcodeName(Opcode opcode)
+{
+    return g_opcodeNames[(size_t)opcode];
+}
+
+Opcode MachineProgram::ComparisonBranch(Opcode comparison, bool whenTrue)
+{
+    switch (comparison) {
+        case Opcode::SETL: return whenTrue ? Opcode::BRL : Opcode::BGE;
+        case Opcode::SETLE: return whenTrue ? Opcode::BLE : Opcode::BRG;
+        case Opcode::SETG: return whenTrue ? Opcode::BRG : Opcode::BLE;
+        case Opcode::SETGE: return whenTrue ? Opcode::BGE : Opcode::BRL;
+        case Opcode::SETE: return whenTrue ? Opcode::BRE : Opcode::BNE;
+        default: return whenTrue ? Opcode::BNE : Opcode::BRE;
+    }
+}
+
+bool MachineProgram::IsTerminator(Opcode opcode)
+{
+    switch (opcode) {
+        case Opcode::BRG:
+        case Opcode::BLE:
+        case Opcode::BRE:
+        case Opcode::BGE:
+        case Opcode::BRL:
+        case Opcode::BNE:
+        case Opcode::BRZ:
+        case Opcode::BNZ:
+        case Opcode::JMP:
+        case Opcode::RET:
+        case Opcode::HLT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MachineProgram::IsInstruction(const MachineInstruction& instruction)
+{
+    // comments and directives kept as raw lines take no address
+    return instruction.opcode != Opcode::RAW || !IsCommentLine(Symbols::Name(instruction.text));
+}
+
+// Printer Functions
+void MachineProgram::PrintLabel(OutputSink& sink, uint32_t label) const
+{
+    const MachineLabel& info = m_labels[label];
+    sink << '.';
+    if (info.name != Symbols::NONE) {
+        sink << Symbols::Name(info.name);
+    } else {
+        sink << 'L' << (int64_t)info.number + m_labelBase << '_';
+    }
+}
+
+void MachineProgram::PrintOperand(OutputSink& sink, const Operand& operand, size_t position)
+{
+    switch (operand.kind) {
+        case OperandKind::REGISTER:
+            sink << 'r' << (int64_t)operand.value;
+            break;
+        case OperandKind::IMMEDIATE:
+            sink << (int64_t)operand.value;
+            break;
+        case OperandKind::LABEL: {
+            if (m_labels[operand.value].relative) {
+                int64_t offset = (int64_t)m_labelPosition[operand.value] - (int64_t)position;
+                sink << (offset < 0 ? "~" : "~+") << offset;
+                break;
+            }
+            uint32_t shown = m_shownLabel[FindLabel(operand.value)];
+            // placed by another program or a later flush, or an exported label that keeps its own name
+            if (shown == NO_LABEL || m_labels[operand.value].exported) {
+                shown = operand.value;
+            }
+            PrintLabel(sink, shown);
+            break;
+        }
+        case OperandKind::NAMED:
+            sink << Symbols::Name(operand.symbol);
+            break;
+        case OperandKind::NONE:
+            break;
+    }
+}
+
+// A run of labels with no instructions between them is one position, every label in it prints as
+// the run's first real label, relative labels only ever print as offsets
+void MachineProgram::MergeAdjacentLabels()
+{
+    m_shownLabel.resize(m_labels.size(), NO_LABEL);
+    m_labelPosition.resize(m_labels.size(), 0);
+
+    uint32_t leader = NO_LABEL;
+    size_t position = 0;
+    for (auto& block: m_blocks) {
+        for (uint32_t label: block.labels) {
+            m_labelPosition[label] = position;
+            if (leader == NO_LABEL) {
+                leader = label;
+            } else {
+                MergeLabels(leader, label);
+            }
+            uint32_t root = FindLabel(leader);
+            if (m_shownLabel[root] == NO_LABEL && !m_labels[label].relative) {
+                m_shownLabel[root] = label;
+            }
+        }
+        for (auto& instruction: block.instructions) {
+            if (IsInstruction(instruction)) {
+                position += 1;
+            }
+        }
+        if (!block.instructions.empty()) {
+            leader = NO_LABEL;
+        }
+    }
+}
+
+void MachineProgram::Flush(OutputSink& sink, uint32_t labelBase)
+{
+    m_labelBase = labelBase;
+    MergeAdjacentLabels();
+
+    size_t position = 0;
+    for (auto& block: m_blocks) {
+        for (uint32_t label: block.labels) {
+            const MachineLabel& info = m_labels[label];
+            if (!info.relative && (m_shownLabel[FindLabel(label)] == label || info.exported)) {
+                PrintLabel(sink, label);
+                sink << '\n';
+            }
+        }
+        for (auto& instruction: block.instructions) {
+            sink << "    ";
+            if (instruction.opcode == Opcode::RAW) {
+                sink << Symbols::Name(instruction.text);
+            } else {
+                sink << OpcodeName(instruction.opcode);
+            }
+            sink << ' ';
+            for (size_t i = 0; i < instruction.count; ++i) {
+                PrintOperand(sink, instruction.ops[i], position);
+                sink << ' ';
+            }
+            sink << '\n';
+            if (IsInstruction(instruction)) {
+                position += 1;
+            }
+        }
+    }
+
+    m_blocks.clear();
+    m_arena.Reset();
+    m_blockEnded = true;
+}
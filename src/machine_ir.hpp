@@ -0,0 +1,174 @@
+#pragma once
+
+#include "arena.hpp"
+#include "symbol.hpp"
+#include "output_sink.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+enum class Opcode : uint8_t
+{
+    ADD,
+    SUB,
+    MLT,
+    DIV,
+    MOD,
+    NOT,
+    INC,
+    DEC,
+    SETL,
+    SETG,
+    SETGE,
+    SETLE,
+    SETE,
+    SETNE,
+    BRG,
+    BLE,
+    BRE,
+    BGE,
+    BRL,
+    BNE,
+    BRZ,
+    BNZ,
+    JMP,
+    IMM,
+    MOV,
+    LOD,
+    STR,
+    LLOD,
+    LSTR,
+    PSH,
+    POP,
+    CAL,
+    RET,
+    HLT,
+    IN,
+    OUT,
+    NOP,
+    RAW, // unrecognised assembly, kept as text
+};
+
+enum class OperandKind : uint8_t
+{
+    NONE,
+    REGISTER,  // rN
+    IMMEDIATE, // decimal integer
+    LABEL,     // label id
+    NAMED,     // anything else, bp, sp, ports, macros, relative jumps
+};
+
+struct Operand
+{
+    OperandKind kind = OperandKind::NONE;
+    int32_t value = 0; // register number, immediate or label id
+    Symbol symbol = Symbols::NONE;
+
+    static Operand Register(int32_t number) { return {OperandKind::REGISTER, number, Symbols::NONE}; }
+    static Operand Immediate(int32_t value) { return {OperandKind::IMMEDIATE, value, Symbols::NONE}; }
+    static Operand Label(uint32_t label) { return {OperandKind::LABEL, (int32_t)label, Symbols::NONE}; }
+    static Operand Named(Symbol name) { return {OperandKind::NAMED, 0, name}; }
+
+    bool IsRegister() const { return kind == OperandKind::REGISTER; }
+    bool IsImmediate(int32_t immediate) const { return kind == OperandKind::IMMEDIATE && value == immediate; }
+    bool operator==(const Operand& other) const { return kind == other.kind && value == other.value && symbol == other.symbol; }
+    bool operator!=(const Operand& other) const { return !(*this == other); }
+};
+
+struct MachineInstruction
+{
+    Opcode opcode;
+    uint8_t count; // operands in use
+    Operand ops[3];
+    Symbol text; // mnemonic for RAW, or the whole line when it does not fit the operands
+    uint32_t line = 0; // B source line it was compiled from, zero when unknown
+
+    const Operand& operator[](size_t i) const { return ops[i]; }
+};
+
+MachineInstruction MakeInstruction(Opcode opcode, Operand a = {}, Operand b = {}, Operand c = {});
+
+using MachineInstructions = std::vector<MachineInstruction, ArenaAllocator<MachineInstruction>>;
+
+// Anonymous labels print as .L<number>_, named ones as .<name>, relative ones as ~+N/~-N at each use
+struct MachineLabel
+{
+    Symbol name;
+    uint32_t number;
+    uint32_t parent; // union-find, labels merged into one position share a root
+    bool relative;
+    bool exported; // may be referenced from another program, so it always gets its own line
+};
+
+// Starts at its labels, ends after a branch, jump, return or halt
+struct BasicBlock
+{
+    std::vector<uint32_t> labels;
+    MachineInstructions instructions;
+
+    explicit BasicBlock(Arena* arena) : instructions(arena) {}
+};
+
+class MachineProgram
+{
+public:
+    MachineProgram();
+    MachineProgram(const MachineProgram&) = delete;
+    MachineProgram& operator=(const MachineProgram&) = delete;
+
+    // Label Functions
+    uint32_t NewLabel();
+    uint32_t NamedLabel(Symbol name);
+    uint32_t RelativeLabel();
+    void PlaceLabel(uint32_t label);
+    uint32_t FindLabel(uint32_t label);
+    void MergeLabels(uint32_t label, uint32_t alias);
+    void ExportLabel(uint32_t label);
+    uint32_t AnonymousLabels() const;
+
+    // Emit Functions, instructions are tagged with the source line set last
+    void SetLine(uint32_t line);
+    uint32_t Line() const;
+    void Emit(Opcode opcode, Operand a = {}, Operand b = {}, Operand c = {});
+    void EmitAssembly(const std::vector<std::string>& lines);
+
+    std::vector<BasicBlock>& Blocks();
+    // prints the blocks emitted so far and drops them, labels stay valid across flushes,
+    // anonymous labels print offset by labelBase so separately built programs can be concatenated
+    void Flush(OutputSink& sink, uint32_t labelBase = 0);
+    // forgets every block and label
+    void Reset();
+
+    static const char* OpcodeName(Opcode opcode);
+    // the branch taken when a SET<cc> comparison would set its result, or when it would not
+    static Opcode ComparisonBranch(Opcode comparison, bool whenTrue);
+    static bool IsTerminator(Opcode opcode);
+    static bool IsInstruction(const MachineInstruction& instruction);
+
+private:
+    // Program Info
+    Arena m_arena;
+    std::vector<BasicBlock> m_blocks;
+    std::vector<MachineLabel> m_labels;
+    std::unordered_map<Symbol, uint32_t> m_namedLabels;
+    uint32_t m_anonymousLabels;
+    uint32_t m_labelBase;
+    uint32_t m_line;
+    bool m_blockEnded;
+
+    // Printer Functions
+    void PrintLabel(OutputSink& sink, uint32_t label) const;
+    void PrintOperand(OutputSink& sink, const Operand& operand, size_t position);
+    void MergeAdjacentLabels();
+
+    // Assembly Functions
+    Operand ParseOperand(std::string_view word);
+    bool ParseRelative(std::string_view word, int32_t& offset);
+
+    // Printer Info, positions are relative to the current flush
+    std::vector<uint32_t> m_shownLabel;
+    std::vector<size_t> m_labelPosition;
+};
@@ -2,95 +2,511 @@
 #include "lexer.hpp"
 #include "ir.hpp"
 #include "compiler.hpp"
+#include "thread_pool.hpp"
+#include "ir_cache.hpp"
+#include "library.hpp"
+#include "file.hpp"
+#include "object_file.hpp"
+#include "compile_cache.hpp"
+#include "server.hpp"
+#include "diagnostics.hpp"
+#include "report.hpp"
 
 #include <iostream>
+#include <memory>
 #include <filesystem>
+#include <charconv>
 
 namespace fs = std::filesystem;
 
 static inline int PrintUsage()
 {
-    std::cout << "[USAGE]:\n    bcc <...input> -o <output>";
+    std::cout << "[USAGE]:\n    bcc <...input> -o <output> [-c] [-j <jobs>] [-nostdlib] [-fno-lib-cache] [-fno-lazy-lib] [-fcompile-cache[=<dir>]] [-ftime-report[=json]] [-fmem-report[=json]] [--peephole-stats]";
+    std::cout << "\n        [-O0|-O1|-O2|-Os] [-fno-<pass>] [-Rpass[=<regex>]] [-Rpass-missed[=<regex>]] [-Rpass-analysis[=<regex>]]";
+    std::cout << "\n    bcc --each <...input> [--outdir <dir>] [-j <jobs>] [options]";
+    std::cout << "\n    bcc --serve[=<socket>]";
+    std::cout << "\n    bcc --connect[=<socket>] <...input> -o <output> [options]";
     return 1;
 }
 
-int main(int argc, char** argv)
-{
-    if (argc == 1)
-        return PrintUsage();
+// Symbols the compile server lets requests accumulate before it releases them
+static constexpr size_t MAX_SERVER_SYMBOLS = 1 << 16;
 
+struct Options
+{
     bool nostdlib = false;
+    bool libCache = true;
+    bool lazyLib = true;
+    bool peepholeStats = false;
+    bool compileOnly = false;
+    bool each = false;
+    bool timeReport = false;
+    bool memReport = false;
+    Report::Format reportFormat = Report::Format::HUMAN;
+    RemarkFilter remarks;
+    PassManager passes;
+    std::string compileCache;
+    size_t jobs = 1;
     std::vector<std::string> inputFiles;
     std::string outputFile;
+    std::string outputDirectory;
+};
+
+// Every source file gets its own Lexer and IRGenerator so they can be generated concurrently
+struct SourceUnit
+{
+    std::string path;
+    const IRCache* cache;
+    bool object;
+    bool badObject;
+    bool unreadable;
+    IRGenerator irGen;
+    IRInfo irInfo;
+};
+
+static size_t CountIR(const IRInfo& irInfo)
+{
+    size_t count = 0;
+    for (auto& global: irInfo.globalsMap) {
+        count += global.second.irValues.values.size();
+    }
+    return count;
+}
+
+static void GenerateUnit(SourceUnit& unit, Report* report)
+{
+    if (unit.object) {
+        Report::Scope scope(report, "read object", unit.path);
+        unit.badObject = !ObjectFile::Read(unit.path, unit.irInfo);
+        return;
+    }
+
+    File::Mapping file;
+    if (!file.Open(unit.path)) {
+        unit.unreadable = true;
+        return;
+    }
+    std::string_view source = file.View();
 
+    if (unit.cache) {
+        Report::Scope scope(report, "load cached ir", unit.path);
+        if (unit.cache->Load(source, unit.irInfo))
+            return;
+    }
+
+    // lexing is streamed into the generator, so the two are one phase
+    {
+        Report::Scope scope(report, "generate", unit.path);
+        unit.irGen.SetSourceName(unit.path);
+        unit.irInfo = unit.irGen.Generate(source);
+        if (report) {
+            scope.Count("bytes", source.size());
+            scope.Count("tokens", unit.irGen.TokensRead());
+            scope.Count("ir instructions", CountIR(unit.irInfo));
+        }
+    }
+
+    if (unit.cache && !unit.irGen.HasErrors()) {
+        Report::Scope scope(report, "store cached ir", unit.path);
+        unit.cache->Store(source, unit.irInfo);
+    }
+}
+
+// Returns false after printing what was wrong, the caller then prints the usage
+static bool ParseOptions(const std::vector<std::string>& args, Options& options)
+{
     // ill make this cleaner in the future
-    for (int i = 1; i < argc; ++i) {
-        std::string str = argv[i];
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& str = args[i];
         if (str == "-nostdlib") {
-            nostdlib = true;
+            options.nostdlib = true;
+        } else if (str == "-fno-lib-cache") {
+            options.libCache = false;
+        } else if (str == "-fno-lazy-lib") {
+            options.lazyLib = false;
+        } else if (str == "--peephole-stats") {
+            options.peepholeStats = true;
+        } else if (str == "-c") {
+            options.compileOnly = true;
+        } else if (str == "-ftime-report" || str == "-ftime-report=json") {
+            options.timeReport = true;
+            if (str.size() > 13) {
+                options.reportFormat = Report::Format::JSON;
+            }
+        } else if (str == "-fmem-report" || str == "-fmem-report=json") {
+            options.memReport = true;
+            if (str.size() > 12) {
+                options.reportFormat = Report::Format::JSON;
+            }
+        } else if (str.rfind("-O", 0) == 0) {
+            PassManager::Level level;
+            if (!PassManager::ParseLevel(str, level)) {
+                std::cerr << "[CLI ERROR]: Unknown optimization level " << str << "!\n";
+                return false;
+            }
+            options.passes.SetLevel(level);
+        } else if (str.rfind("-fno-", 0) == 0 && str.size() > 5) {
+            if (!options.passes.Disable(str.substr(5))) {
+                std::cerr << "[CLI ERROR]: Unknown pass in " << str << "!\n";
+                return false;
+            }
+        } else if (str.rfind("-Rpass", 0) == 0) {
+            // a bare flag wants every remark of its kind
+            size_t equals = str.find('=');
+            std::string flag = str.substr(0, equals);
+            std::string pattern = equals == std::string::npos ? ".*" : str.substr(equals + 1);
+            RemarkFilter::Kind kind;
+            if (flag == "-Rpass") {
+                kind = RemarkFilter::Kind::PASSED;
+            } else if (flag == "-Rpass-missed") {
+                kind = RemarkFilter::Kind::MISSED;
+            } else if (flag == "-Rpass-analysis") {
+                kind = RemarkFilter::Kind::ANALYSIS;
+            } else {
+                std::cerr << "[CLI ERROR]: Unknown remark flag " << flag << "!\n";
+                return false;
+            }
+            if (!options.remarks.Enable(kind, pattern)) {
+                std::cerr << "[CLI ERROR]: Invalid pattern after " << flag << "!\n";
+                return false;
+            }
+        } else if (str == "--each") {
+            options.each = true;
+        } else if (str == "--outdir") {
+            if (i + 1 >= args.size() || args[i + 1][0] == '-') {
+                std::cerr << "[CLI ERROR]: No output directory specified after --outdir!\n";
+                return false;
+            }
+            options.outputDirectory = args[++i];
+        } else if (str == "-fcompile-cache") {
+            options.compileCache = CompileCache::DEFAULT_DIRECTORY;
+        } else if (str.rfind("-fcompile-cache=", 0) == 0 && str.size() > 16) {
+            options.compileCache = str.substr(16);
         } else if (str == "-o") {
-            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+            if (i + 1 >= args.size() || args[i + 1][0] == '-') {
                 std::cerr << "[CLI ERROR]: No output file specified after -o!\n";
-                return PrintUsage();
+                return false;
             }
-            outputFile = argv[++i];
-            fs::path path = outputFile;
-            if (path.extension().empty()) {
-                outputFile += ".urcl";
+            options.outputFile = args[++i];
+        } else if (str.rfind("-j", 0) == 0) {
+            std::string count = str.size() > 2 ? str.substr(2) : "";
+            if (count.empty() && i + 1 < args.size()) {
+                count = args[++i];
             }
+            size_t jobs = 0;
+            auto parsed = std::from_chars(count.data(), count.data() + count.size(), jobs);
+            if (count.empty() || parsed.ec != std::errc() || parsed.ptr != count.data() + count.size() || jobs == 0) {
+                std::cerr << "[CLI ERROR]: Invalid job count after -j!\n";
+                return false;
+            }
+            options.jobs = jobs;
         } else {
-            inputFiles.push_back(str);
+            options.inputFiles.push_back(str);
         }
     }
 
-    if (outputFile.empty()) {
+    if (options.each && (options.compileOnly || !options.outputFile.empty())) {
+        std::cerr << "[FATAL ERROR]: --each names every output itself, it cannot be used with -o or -c!\n";
+        return false;
+    }
+
+    if (!options.each && !options.outputDirectory.empty()) {
+        std::cerr << "[FATAL ERROR]: --outdir is only used with --each!\n";
+        return false;
+    }
+
+    if (options.outputFile.empty() && !options.compileOnly && !options.each) {
         std::cerr << "[FATAL ERROR]: No output file provided!\n";
-        return PrintUsage();
+        return false;
     }
 
-    if (inputFiles.empty()) {
+    if (options.inputFiles.empty()) {
         std::cerr << "[FATAL ERROR]: No input files provided!\n";
-        return PrintUsage();
+        return false;
     }
 
-    Lexer lexer;
-    IRGenerator irGen;
-    Compiler compiler;
+    if (options.compileOnly && !options.outputFile.empty() && options.inputFiles.size() > 1) {
+        std::cerr << "[FATAL ERROR]: -o cannot be used with -c and multiple input files!\n";
+        return false;
+    }
+
+    if (!options.outputFile.empty() && fs::path(options.outputFile).extension().empty()) {
+        options.outputFile += options.compileOnly ? ObjectFile::EXTENSION : ".urcl";
+    }
+    return true;
+}
+
+// One whole program. The library outlives it when running as a server or a batch, so its scan
+// and the definitions it already parsed are reused by every later program
+static int RunProgram(const Options& options, Library& library, Report* report)
+{
+    std::vector<std::string> sources;
+    size_t libCount;
+
+    // Library Code, parsed whole only when lazy loading is off, object modules never contain it
+    if (!options.nostdlib && !options.compileOnly) {
+        if (!library.Scanned()) {
+            Report::Scope scope(report, "library scan");
+            if (!library.Scan())
+                return 1;
+        }
+        if (!options.lazyLib) {
+            sources = library.GetFiles();
+        }
+    }
+
+    libCount = sources.size();
+
+    // User Code
+    for (auto& source: options.inputFiles) {
+        if (!fs::is_regular_file(source)) {
+            std::cerr << "[FATAL ERROR]: could not find file '" << source << "'\n";
+            std::cerr << "Compilation Terminated.";
+            return 1;
+        }
+        if (options.compileOnly && ObjectFile::IsObjectPath(source)) {
+            std::cerr << "[FATAL ERROR]: '" << source << "' is already an object module\n";
+            std::cerr << "Compilation Terminated.";
+            return 1;
+        }
+        sources.push_back(source);
+    }
 
+    // Compile Cache, the peephole stats and remarks only exist when the program is really compiled
+    std::unique_ptr<CompileCache> outputCache;
+    if (!options.compileCache.empty() && !options.compileOnly && !options.peepholeStats && !options.remarks.Any()) {
+        outputCache = std::make_unique<CompileCache>(options.compileCache);
+        outputCache->AddFlag(options.nostdlib ? "-nostdlib" : "");
+        outputCache->AddFlag(options.lazyLib ? "" : "-fno-lazy-lib");
+        outputCache->AddFlag(options.passes.Flags());
+        bool hashed = true;
+        for (auto& source: options.inputFiles) {
+            hashed = outputCache->AddFile(source) && hashed;
+        }
+        if (!options.nostdlib) {
+            for (auto& source: library.GetFiles()) {
+                hashed = outputCache->AddFile(source) && hashed;
+            }
+        }
+        Report::Scope scope(report, "fetch compile cache");
+        if (hashed && outputCache->Fetch(options.outputFile))
+            return 0;
+        if (!hashed) {
+            outputCache.reset();
+        }
+    }
+
+    IRCache cache(library.GetCacheDirectory());
+    std::vector<SourceUnit> units(sources.size());
+    {
+        ThreadPool pool(options.jobs);
+        for (size_t i = 0; i < sources.size(); ++i) {
+            units[i].path = sources[i];
+            units[i].cache = (options.libCache && i < libCount) ? &cache : nullptr;
+            units[i].object = ObjectFile::IsObjectPath(sources[i]);
+            units[i].badObject = false;
+            units[i].unreadable = false;
+            pool.Submit([&unit = units[i], report] { GenerateUnit(unit, report); });
+        }
+        pool.Wait();
+    }
+
+    // Errors are reported in input order, stopping at the first file that failed
     std::vector<IRInfo> toLink;
+    for (auto& unit: units) {
+        if (unit.unreadable) {
+            std::cerr << "[FATAL ERROR]: could not read file '" << unit.path << "'\n";
+            std::cerr << "Compilation Terminated.";
+            return 1;
+        }
+        if (unit.irGen.PrintErrors())
+            return 1;
+        if (unit.badObject) {
+            std::cerr << "[FATAL ERROR]: '" << unit.path << "' is not a valid object module\n";
+            std::cerr << "Compilation Terminated.";
+            return 1;
+        }
+        toLink.push_back(std::move(unit.irInfo));
+    }
 
-    // Library Code
-    if (!nostdlib) {
-        try {
-            for (auto& entry: fs::recursive_directory_iterator("lib")) {
-                if (fs::is_regular_file(entry) && entry.path().extension() == ".b") {
-                    std::string source = entry.path().string();
-
-                    irGen.SetSourceName(source);
-                    auto tokens = lexer.Tokenize(source);
-                    auto irInfo = irGen.Generate(tokens);
-                    if (irGen.PrintErrors())
-                        return 1;
-                    toLink.push_back(irInfo);
-                }
+    // Separate Compilation, every source becomes an object module and linking is left for later
+    if (options.compileOnly) {
+        Report::Scope scope(report, "write objects");
+        for (size_t i = 0; i < toLink.size(); ++i) {
+            std::string objectFile = options.outputFile;
+            if (objectFile.empty()) {
+                objectFile = fs::path(sources[i]).replace_extension(ObjectFile::EXTENSION).filename().string();
+            }
+            if (!ObjectFile::Write(objectFile, toLink[i])) {
+                std::cerr << "[FATAL ERROR]: could not write object module '" << objectFile << "'\n";
+                std::cerr << "Compilation Terminated.";
+                return 1;
             }
-        } catch (const fs::filesystem_error& e) {
-            std::cerr << "[FATAL ERROR]: " << e.what() << '\n';
+        }
+        return 0;
+    }
+
+    // Only the library definitions reachable from the user code are parsed
+    if (!options.nostdlib && options.lazyLib) {
+        Report::Scope scope(report, "load library");
+        if (!library.LoadReferenced(toLink, options.libCache ? &cache : nullptr))
+            return 1;
+    }
+
+    Compiler compiler;
+    compiler.SetPeepholeStats(options.peepholeStats);
+    compiler.SetJobs(options.jobs);
+    compiler.SetReport(report);
+    compiler.SetRemarks(&options.remarks);
+    compiler.SetPasses(options.passes);
+    compiler.LinkAndCompile(std::move(toLink), options.outputFile);
+
+    if (compiler.HasErrors())
+        return 1;
+
+    if (outputCache) {
+        Report::Scope scope(report, "store compile cache");
+        outputCache->Store(options.outputFile);
+    }
+    return 0;
+}
+
+// Reports go to std::cerr after the program, whether it compiled or not
+static int Run(const Options& options, Library& library)
+{
+    if (!options.timeReport && !options.memReport)
+        return RunProgram(options, library, nullptr);
+
+    if (options.memReport) {
+        Report::CountAllocations();
+    }
+    Report report;
+    int status;
+    {
+        Report::Scope scope(&report, "total");
+        status = RunProgram(options, library, &report);
+    }
+    report.Print(std::cerr, options.reportFormat, options.timeReport, options.memReport);
+    return status;
+}
+
+// Batch Mode, every input is its own program. They run side by side on one pool and share the
+// library, each one's diagnostics are held back and reported in input order
+static int RunEach(const Options& options, Library& library)
+{
+    fs::path directory = options.outputDirectory.empty() ? "." : options.outputDirectory;
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error) {
+        std::cerr << "[FATAL ERROR]: could not create output directory '" << directory.string() << "'\n";
+        std::cerr << "Compilation Terminated.";
+        return 1;
+    }
+
+    std::vector<Options> programs(options.inputFiles.size(), options);
+    std::unordered_map<std::string, std::string> outputs;
+    for (size_t i = 0; i < programs.size(); ++i) {
+        const std::string& input = options.inputFiles[i];
+        programs[i].each = false;
+        programs[i].jobs = 1;
+        programs[i].inputFiles = {input};
+        programs[i].outputFile = (directory / fs::path(input).stem()).string() + ".urcl";
+
+        auto result = outputs.emplace(programs[i].outputFile, input);
+        if (!result.second) {
+            std::cerr << "[FATAL ERROR]: '" << result.first->second << "' and '" << input << "' would both write '" << programs[i].outputFile << "'\n";
             std::cerr << "Compilation Terminated.";
             return 1;
         }
     }
 
-    // User Code
-    for (auto& source: inputFiles) {
+    // scanned up front, the programs only ever read the index
+    if (!options.nostdlib && !library.Scanned() && !library.Scan())
+        return 1;
+    library.SetKeepLoaded(true);
+
+    std::vector<int> statuses(programs.size(), 1);
+    std::vector<std::string> reports(programs.size());
+    {
+        ThreadPool pool(options.jobs);
+        for (size_t i = 0; i < programs.size(); ++i) {
+            // one program failing in any way must not take the rest of the batch with it
+            pool.Submit([&, i] {
+                Diagnostics::Capture capture;
+                try {
+                    statuses[i] = Run(programs[i], library);
+                } catch (const std::exception& e) {
+                    std::cerr << "[FATAL ERROR]: " << e.what() << '\n';
+                    std::cerr << "Compilation Terminated.";
+                }
+                reports[i] = capture.Text();
+            });
+        }
+        pool.Wait();
+    }
 
-        irGen.SetSourceName(source);
-        auto tokens = lexer.Tokenize(source);
-        auto irInfo = irGen.Generate(tokens);
-        if (irGen.PrintErrors())
+    size_t failed = 0;
+    for (size_t i = 0; i < programs.size(); ++i) {
+        std::cerr << reports[i];
+        if (!reports[i].empty() && reports[i].back() != '\n') {
+            std::cerr << '\n';
+        }
+        if (statuses[i] == 0) {
+            std::cerr << "[BATCH]: ok " << options.inputFiles[i] << " -> " << programs[i].outputFile << '\n';
+        } else {
+            std::cerr << "[BATCH]: FAILED " << options.inputFiles[i] << '\n';
+            failed += 1;
+        }
+    }
+    std::cerr << "[BATCH]: " << programs.size() - failed << " succeeded, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
+
+static int Compile(const std::vector<std::string>& args, Library& library)
+{
+    if (args.empty())
+        return PrintUsage();
+
+    Options options;
+    if (!ParseOptions(args, options))
+        return PrintUsage();
+
+    return options.each ? RunEach(options, library) : Run(options, library);
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    // Compile Server, keeps the library warm between requests from --connect clients
+    if (!args.empty() && (args[0] == "--serve" || args[0].rfind("--serve=", 0) == 0)) {
+        std::string socketPath = args[0].size() > 8 ? args[0].substr(8) : Server::DEFAULT_SOCKET;
+        Library library(fs::absolute("lib").string(), fs::absolute("lib/.cache").string());
+        library.SetKeepLoaded(true);
+        if (!library.Scan())
             return 1;
-        toLink.push_back(irInfo);
+        // every request interns its own identifiers and strings, past a budget they are released
+        // together with the library definitions kept since, which hold ids from after the scan.
+        // The index is rebuilt by the rescan every request starts with, so none of its ids outlive it
+        size_t scanned = Symbols::Count();
+        return Server::Serve(socketPath, [&library, scanned](const std::vector<std::string>& request) {
+            if (Symbols::Count() - scanned > MAX_SERVER_SYMBOLS) {
+                library.SetKeepLoaded(false);
+                library.SetKeepLoaded(true);
+                Symbols::Release(scanned);
+            }
+            // the library may have been edited since the last request
+            if (!library.Scan())
+                return 1;
+            return Compile(request, library);
+        });
     }
 
-    compiler.LinkAndCompile(toLink, outputFile);
-}
\ No newline at end of file
+    if (!args.empty() && (args[0] == "--connect" || args[0].rfind("--connect=", 0) == 0)) {
+        std::string socketPath = args[0].size() > 10 ? args[0].substr(10) : Server::DEFAULT_SOCKET;
+        return Server::Connect(socketPath, std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+
+    Library library("lib", "lib/.cache");
+    return Compile(args, library);
+}
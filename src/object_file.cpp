@@ -0,0 +1,41 @@
+#include "object_file.hpp"
+#include "serializer.hpp"
+
+#include <fstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Bump whenever the IR or its encoding changes, objects from older compilers are then rejected
+static constexpr uint64_t OBJECT_MAGIC = 0x314a424f43434200ULL; // "\0BCCOBJ1"
+static constexpr uint64_t OBJECT_VERSION = 3;
+
+bool ObjectFile::Write(const std::string& path, const IRInfo& irInfo)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    Serializer::WriteU64(file, OBJECT_MAGIC);
+    Serializer::WriteU64(file, OBJECT_VERSION);
+    Serializer::WriteIRInfo(file, irInfo);
+    return (bool)file;
+}
+
+bool ObjectFile::Read(const std::string& path, IRInfo& irInfo)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    uint64_t magic, version;
+    if (!Serializer::ReadU64(file, magic) || magic != OBJECT_MAGIC)
+        return false;
+    if (!Serializer::ReadU64(file, version) || version != OBJECT_VERSION)
+        return false;
+    return Serializer::ReadIRInfo(file, irInfo);
+}
+
+bool ObjectFile::IsObjectPath(const std::string& path)
+{
+    return fs::path(path).extension() == EXTENSION;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ir.hpp"
+
+// Object modules written by `bcc -c`, one source file's IRInfo. Its globals and references
+// are the symbol and reference tables the link step resolves against
+namespace ObjectFile
+{
+    static constexpr const char* EXTENSION = ".bo";
+
+    bool Write(const std::string& path, const IRInfo& irInfo);
+    bool Read(const std::string& path, IRInfo& irInfo);
+    bool IsObjectPath(const std::string& path);
+}
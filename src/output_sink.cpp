@@ -0,0 +1,60 @@
+#include "output_sink.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+
+OutputSink::OutputSink(std::ostream& stream, size_t chunkSize)
+    : m_stream(stream), m_chunk(new char[chunkSize])
+{
+    m_chunkSize = chunkSize;
+    m_used = 0;
+    m_written = 0;
+}
+
+OutputSink::~OutputSink()
+{
+    Flush();
+}
+
+void OutputSink::Write(std::string_view text)
+{
+    while (!text.empty()) {
+        if (m_used == m_chunkSize) {
+            Flush();
+        }
+        size_t count = std::min(text.size(), m_chunkSize - m_used);
+        std::memcpy(m_chunk.get() + m_used, text.data(), count);
+        m_used += count;
+        text.remove_prefix(count);
+    }
+}
+
+void OutputSink::Write(char c)
+{
+    if (m_used == m_chunkSize) {
+        Flush();
+    }
+    m_chunk[m_used++] = c;
+}
+
+void OutputSink::WriteInteger(int64_t value)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    Write(std::string_view(digits, result.ptr - digits));
+}
+
+void OutputSink::Flush()
+{
+    if (m_used) {
+        m_stream.write(m_chunk.get(), m_used);
+        m_written += m_used;
+        m_used = 0;
+    }
+}
+
+size_t OutputSink::BytesWritten() const
+{
+    return m_written + m_used;
+}
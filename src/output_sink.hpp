@@ -0,0 +1,37 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+#include <cstdint>
+#include <memory>
+
+// Buffers writes into fixed size chunks and hands each full chunk to the stream,
+// so nothing ever holds more than one chunk of output
+class OutputSink
+{
+public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    explicit OutputSink(std::ostream& stream, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+    ~OutputSink();
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    void Write(std::string_view text);
+    void Write(char c);
+    void WriteInteger(int64_t value);
+    void Flush();
+    size_t BytesWritten() const;
+
+    OutputSink& operator<<(std::string_view text) { Write(text); return *this; }
+    OutputSink& operator<<(char c) { Write(c); return *this; }
+    OutputSink& operator<<(int64_t value) { WriteInteger(value); return *this; }
+
+private:
+    // Sink Info
+    std::ostream& m_stream;
+    std::unique_ptr<char[]> m_chunk;
+    size_t m_chunkSize;
+    size_t m_used;
+    size_t m_written;
+};
@@ -0,0 +1,103 @@
+#include "pass_manager.hpp"
+
+#include <algorithm>
+
+static const Pass g_passes[] = {
+    {PassId::FOLD_CONSTANTS, "fold-constants", "pass fold-constants", PassKind::IR},
+    {PassId::PEEPHOLE, "peephole", "pass peephole", PassKind::MACHINE},
+    {PassId::STACK_PAIRS, "stack-pairs", "pass stack-pairs", PassKind::MACHINE},
+    {PassId::TAIL_DUPLICATE, "tail-duplicate", "pass tail-duplicate", PassKind::MACHINE},
+    {PassId::TREE_SELECT, "tree-select", "codegen", PassKind::CODEGEN},
+};
+
+// Pipelines, by level. Stack pairs leave copies behind that the peephole rules fold further
+static const std::vector<PassId> g_pipelines[] = {
+    {},
+    {PassId::FOLD_CONSTANTS, PassId::TREE_SELECT, PassId::PEEPHOLE},
+    {PassId::FOLD_CONSTANTS, PassId::TREE_SELECT, PassId::PEEPHOLE, PassId::STACK_PAIRS, PassId::PEEPHOLE, PassId::TAIL_DUPLICATE},
+    {PassId::FOLD_CONSTANTS, PassId::TREE_SELECT, PassId::PEEPHOLE, PassId::STACK_PAIRS, PassId::PEEPHOLE},
+};
+
+static const char* g_levelNames[] = {"-O0", "-O1", "-O2", "-Os"};
+
+PassManager::PassManager()
+{
+    m_level = Level::O1;
+    Build();
+}
+
+void PassManager::Build()
+{
+    m_pipeline.clear();
+    for (PassId id: g_pipelines[(size_t)m_level]) {
+        const Pass& pass = g_passes[(size_t)id];
+        if (std::find(m_disabled.begin(), m_disabled.end(), pass.name) == m_disabled.end()) {
+            m_pipeline.push_back(&pass);
+        }
+    }
+}
+
+void PassManager::SetLevel(Level level)
+{
+    m_level = level;
+    Build();
+}
+
+bool PassManager::Disable(const std::string& name)
+{
+    for (auto& pass: g_passes) {
+        if (name != pass.name)
+            continue;
+        if (std::find(m_disabled.begin(), m_disabled.end(), name) == m_disabled.end()) {
+            m_disabled.push_back(name);
+            std::sort(m_disabled.begin(), m_disabled.end());
+        }
+        Build();
+        return true;
+    }
+    return false;
+}
+
+bool PassManager::ParseLevel(const std::string& flag, Level& level)
+{
+    if (flag == "-O0") {
+        level = Level::O0;
+    } else if (flag == "-O" || flag == "-O1") {
+        level = Level::O1;
+    } else if (flag == "-O2") {
+        level = Level::O2;
+    } else if (flag == "-Os") {
+        level = Level::OS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const std::vector<const Pass*>& PassManager::Pipeline() const
+{
+    return m_pipeline;
+}
+
+bool PassManager::Runs(PassId id) const
+{
+    for (const Pass* pass: m_pipeline) {
+        if (pass->id == id)
+            return true;
+    }
+    return false;
+}
+
+const char* PassManager::LevelName() const
+{
+    return g_levelNames[(size_t)m_level];
+}
+
+std::string PassManager::Flags() const
+{
+    std::string flags = m_level == Level::O1 ? "" : LevelName();
+    for (auto& name: m_disabled) {
+        flags += (flags.empty() ? "-fno-" : " -fno-") + name;
+    }
+    return flags;
+}
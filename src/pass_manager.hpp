@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum class PassId : uint8_t
+{
+    FOLD_CONSTANTS,
+    PEEPHOLE,
+    STACK_PAIRS,
+    TAIL_DUPLICATE,
+    TREE_SELECT,
+};
+
+// IR passes rewrite a function's IR before codegen, machine passes its machine program after.
+// Codegen passes change how codegen itself works and are timed as part of it
+enum class PassKind : uint8_t
+{
+    IR,
+    CODEGEN,
+    MACHINE,
+};
+
+struct Pass
+{
+    PassId id;
+    const char* name;  // for -fno-<name> and remarks
+    const char* phase; // in -ftime-report
+    PassKind kind;
+};
+
+// Chooses the passes every function goes through, in order, from the -O level and the -fno-<pass> flags.
+// A pass may run more than once in a pipeline, disabling it drops every run
+class PassManager
+{
+public:
+    enum class Level
+    {
+        O0, // codegen only
+        O1, // the cheap passes
+        O2, // everything, including passes that grow the code to make it faster
+        OS, // everything that does not grow the code
+    };
+
+    PassManager();
+
+    void SetLevel(Level level);
+    // false when no pass has that name
+    bool Disable(const std::string& name);
+    // -O0, -O1, -O2 or -Os, a bare -O is -O1
+    static bool ParseLevel(const std::string& flag, Level& level);
+
+    const std::vector<const Pass*>& Pipeline() const;
+    bool Runs(PassId id) const;
+    const char* LevelName() const;
+    // the flags that chose the pipeline, empty for the default one
+    std::string Flags() const;
+
+private:
+    // Pipeline Info
+    Level m_level;
+    std::vector<std::string> m_disabled;
+    std::vector<const Pass*> m_pipeline;
+
+    void Build();
+};
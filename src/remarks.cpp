@@ -0,0 +1,35 @@
+#include "remarks.hpp"
+
+bool RemarkFilter::Enable(Kind kind, const std::string& pattern)
+{
+    try {
+        m_patterns[(size_t)kind] = std::regex(pattern, std::regex::nosubs);
+    } catch (const std::regex_error&) {
+        return false;
+    }
+    return true;
+}
+
+bool RemarkFilter::Wants(Kind kind, const std::string& name) const
+{
+    auto& pattern = m_patterns[(size_t)kind];
+    return pattern.has_value() && std::regex_match(name, *pattern);
+}
+
+bool RemarkFilter::Any() const
+{
+    for (auto& pattern: m_patterns) {
+        if (pattern.has_value())
+            return true;
+    }
+    return false;
+}
+
+const char* RemarkFilter::FlagName(Kind kind)
+{
+    switch (kind) {
+        case Kind::PASSED: return "-Rpass";
+        case Kind::MISSED: return "-Rpass-missed";
+        default: return "-Rpass-analysis";
+    }
+}
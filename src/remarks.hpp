@@ -0,0 +1,36 @@
+#pragma once
+
+#include <regex>
+#include <optional>
+#include <string>
+#include <cstdint>
+
+// Optimization remarks behind -Rpass, -Rpass-missed and -Rpass-analysis. Every remark is named after
+// the rule or pass that made it, each flag keeps the remarks whose whole name its pattern matches
+class RemarkFilter
+{
+public:
+    enum class Kind
+    {
+        PASSED,
+        MISSED,
+        ANALYSIS
+    };
+
+    // false when the pattern is not a valid regular expression
+    bool Enable(Kind kind, const std::string& pattern);
+    bool Wants(Kind kind, const std::string& name) const;
+    bool Any() const;
+    static const char* FlagName(Kind kind);
+
+private:
+    std::optional<std::regex> m_patterns[3];
+};
+
+struct Remark
+{
+    RemarkFilter::Kind kind;
+    const char* name;
+    uint32_t line;
+    std::string message;
+};
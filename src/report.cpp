@@ -0,0 +1,268 @@
+#include "report.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Allocation Counting, the replaced global operator new counts per thread once it is switched on
+static std::atomic<bool> g_countAllocations{false};
+static thread_local uint64_t t_allocations = 0;
+static thread_local uint64_t t_allocatedBytes = 0;
+
+void* operator new(std::size_t size)
+{
+    if (g_countAllocations.load(std::memory_order_relaxed)) {
+        t_allocations += 1;
+        t_allocatedBytes += size;
+    }
+    void* pointer = std::malloc(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void Report::CountAllocations()
+{
+    g_countAllocations.store(true, std::memory_order_relaxed);
+}
+
+// Clock Functions
+static double ThreadCpuSeconds()
+{
+#ifndef _WIN32
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#else
+    return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static int64_t PeakRss()
+{
+#ifndef _WIN32
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// Scope Functions
+Report::Scope::Scope(Report* report, const char* phase, const std::string& file)
+    : m_report(report), m_phase(phase)
+{
+    if (!m_report)
+        return;
+    m_file = file;
+    m_wallStart = std::chrono::steady_clock::now();
+    m_cpuStart = ThreadCpuSeconds();
+    m_allocationsStart = t_allocations;
+    m_bytesStart = t_allocatedBytes;
+}
+
+Report::Scope::~Scope()
+{
+    if (!m_report)
+        return;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wallStart).count();
+    double cpu = ThreadCpuSeconds() - m_cpuStart;
+    m_report->Add(*this, wall, cpu, t_allocations - m_allocationsStart, t_allocatedBytes - m_bytesStart);
+}
+
+void Report::Scope::Count(const char* name, uint64_t value)
+{
+    if (!m_report)
+        return;
+    for (auto& count: m_counts) {
+        if (count.first == name) {
+            count.second += value;
+            return;
+        }
+    }
+    m_counts.emplace_back(name, value);
+}
+
+// Report Functions
+static void AddCount(std::vector<std::pair<std::string, uint64_t>>& counts, const std::string& name, uint64_t value)
+{
+    for (auto& count: counts) {
+        if (count.first == name) {
+            count.second += value;
+            return;
+        }
+    }
+    counts.emplace_back(name, value);
+}
+
+void Report::Add(const Scope& scope, double wall, double cpu, uint64_t allocations, uint64_t bytes)
+{
+    int64_t peakRss = PeakRss();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Entry* entry = nullptr;
+    for (auto& existing: m_entries) {
+        if (existing.phase == scope.m_phase && existing.file == scope.m_file) {
+            entry = &existing;
+            break;
+        }
+    }
+    if (!entry) {
+        m_entries.push_back({scope.m_phase, scope.m_file, 0, 0.0, 0.0, 0, 0, 0, {}});
+        entry = &m_entries.back();
+    }
+
+    entry->runs += 1;
+    entry->wall += wall;
+    entry->cpu += cpu;
+    entry->allocations += allocations;
+    entry->bytes += bytes;
+    entry->peakRss = std::max(entry->peakRss, peakRss);
+    for (auto& count: scope.m_counts) {
+        AddCount(entry->counts, count.first, count.second);
+    }
+}
+
+void Report::Count(const char* name, uint64_t value)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    AddCount(m_counts, name, value);
+}
+
+double Report::Seconds(const std::string& phase) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double seconds = 0;
+    for (auto& entry: m_entries) {
+        if (entry.phase == phase) {
+            seconds += entry.wall;
+        }
+    }
+    return seconds;
+}
+
+static void PrintJsonString(std::ostream& stream, const std::string& text)
+{
+    stream << '"';
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            stream << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+        } else {
+            stream << c;
+        }
+    }
+    stream << '"';
+}
+
+// counts are named for the human report, JSON keys get underscores instead of spaces
+static std::string JsonKey(std::string name)
+{
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return name;
+}
+
+void Report::Print(std::ostream& output, Format format, bool time, bool memory) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // formatted on the side, batch programs print their reports from several threads through std::cerr
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(3);
+
+    if (format == Format::JSON) {
+        stream << "{\"phases\": [";
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            const Entry& entry = m_entries[i];
+            stream << (i ? ",\n    " : "\n    ") << "{\"phase\": ";
+            PrintJsonString(stream, entry.phase);
+            stream << ", \"file\": ";
+            PrintJsonString(stream, entry.file);
+            stream << ", \"runs\": " << entry.runs;
+            if (time) {
+                stream << ", \"wall_ms\": " << entry.wall * 1000 << ", \"cpu_ms\": " << entry.cpu * 1000;
+            }
+            if (memory) {
+                stream << ", \"allocations\": " << entry.allocations << ", \"allocated_bytes\": " << entry.bytes;
+                stream << ", \"peak_rss_kib\": " << entry.peakRss;
+            }
+            for (auto& count: entry.counts) {
+                stream << ", ";
+                PrintJsonString(stream, JsonKey(count.first));
+                stream << ": " << count.second;
+            }
+            stream << '}';
+        }
+        stream << "\n], \"counts\": {";
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            stream << (i ? ", " : "");
+            PrintJsonString(stream, JsonKey(m_counts[i].first));
+            stream << ": " << m_counts[i].second;
+        }
+        stream << "}}\n";
+    } else {
+        for (auto& entry: m_entries) {
+            stream << "[REPORT]: " << entry.phase;
+            if (!entry.file.empty()) {
+                stream << ' ' << entry.file;
+            }
+            if (entry.runs > 1) {
+                stream << " (" << entry.runs << " runs)";
+            }
+            const char* separator = ":";
+            if (time) {
+                stream << separator << " wall " << entry.wall * 1000 << " ms, cpu " << entry.cpu * 1000 << " ms";
+                separator = ",";
+            }
+            if (memory) {
+                stream << separator << ' ' << entry.allocations << " allocations (" << entry.bytes / 1024.0 << " KiB), peak RSS " << entry.peakRss << " KiB";
+                separator = ",";
+            }
+            for (auto& count: entry.counts) {
+                stream << separator << ' ' << count.first << ' ' << count.second;
+                separator = ",";
+            }
+            stream << '\n';
+        }
+        for (auto& count: m_counts) {
+            stream << "[REPORT]: " << count.first << ": " << count.second << '\n';
+        }
+    }
+
+    output << stream.str();
+}
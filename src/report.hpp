@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <cstdint>
+
+// Instrumentation behind -ftime-report and -fmem-report. A Scope measures one phase on the thread
+// it lives on, scopes with the same phase and file add up, so per-function work run on the pool
+// is reported as one line with its run count. A null Report makes every Scope a no-op
+class Report
+{
+public:
+    enum class Format
+    {
+        HUMAN,
+        JSON
+    };
+
+    // heap allocations are only counted once this is called, every thread counts its own
+    static void CountAllocations();
+
+    class Scope
+    {
+    public:
+        Scope(Report* report, const char* phase, const std::string& file = "");
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // adds to a count reported beside this phase, like tokens read or instructions emitted
+        void Count(const char* name, uint64_t value);
+
+    private:
+        friend class Report;
+
+        Report* m_report;
+        const char* m_phase;
+        std::string m_file;
+        std::vector<std::pair<const char*, uint64_t>> m_counts;
+        std::chrono::steady_clock::time_point m_wallStart;
+        double m_cpuStart;
+        uint64_t m_allocationsStart;
+        uint64_t m_bytesStart;
+    };
+
+    // a count that belongs to the whole compile rather than one phase
+    void Count(const char* name, uint64_t value);
+    void Print(std::ostream& stream, Format format, bool time, bool memory) const;
+    // wall time of one phase over every file and run, zero when it never ran
+    double Seconds(const std::string& phase) const;
+
+private:
+    struct Entry
+    {
+        std::string phase;
+        std::string file;
+        size_t runs;
+        double wall, cpu; // seconds
+        uint64_t allocations, bytes;
+        int64_t peakRss;  // KiB, of the whole process when the phase last ended
+        std::vector<std::pair<std::string, uint64_t>> counts;
+    };
+
+    // Report Info
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    std::vector<std::pair<std::string, uint64_t>> m_counts;
+
+    void Add(const Scope& scope, double wall, double cpu, uint64_t allocations, uint64_t bytes);
+};
@@ -0,0 +1,254 @@
+#include "serializer.hpp"
+
+// Anything larger than this is a corrupted stream, not a real B program
+static constexpr uint64_t MAX_LENGTH = 1ULL << 31;
+
+// FNV-1a, 64 bit
+uint64_t Serializer::Hash(std::string_view data)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c: data) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Primitive Functions
+void Serializer::WriteU64(std::ostream& stream, uint64_t value)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = (char)(value >> (i * 8));
+    }
+    stream.write(bytes, 8);
+}
+
+bool Serializer::ReadU64(std::istream& stream, uint64_t& value)
+{
+    unsigned char bytes[8];
+    if (!stream.read((char*)bytes, 8))
+        return false;
+    value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+    return true;
+}
+
+void Serializer::WriteString(std::ostream& stream, const std::string& string)
+{
+    WriteU64(stream, string.size());
+    stream.write(string.data(), string.size());
+}
+
+bool Serializer::ReadString(std::istream& stream, std::string& string)
+{
+    uint64_t size;
+    if (!ReadU64(stream, size) || size > MAX_LENGTH)
+        return false;
+    string.resize(size);
+    return (bool)stream.read(string.data(), size);
+}
+
+// Symbols are process local ids, so they are stored by name and interned again on read
+void Serializer::WriteSymbol(std::ostream& stream, Symbol symbol)
+{
+    WriteString(stream, Symbols::Name(symbol));
+}
+
+bool Serializer::ReadSymbol(std::istream& stream, Symbol& symbol)
+{
+    std::string name;
+    if (!ReadString(stream, name))
+        return false;
+    symbol = Symbols::Intern(name);
+    return true;
+}
+
+// Symbol Tables, each IRInfo names its symbols once and refers to them by index afterwards
+struct SymbolWriteTable
+{
+    std::vector<Symbol> symbols;
+    std::unordered_map<Symbol, uint64_t> indices;
+
+    void Add(Symbol symbol)
+    {
+        if (indices.emplace(symbol, symbols.size()).second) {
+            symbols.push_back(symbol);
+        }
+    }
+};
+
+static void WriteSymbolIndex(std::ostream& stream, const SymbolWriteTable& table, Symbol symbol)
+{
+    Serializer::WriteU64(stream, table.indices.at(symbol));
+}
+
+static bool ReadSymbolIndex(std::istream& stream, const std::vector<Symbol>& table, Symbol& symbol)
+{
+    uint64_t index;
+    if (!Serializer::ReadU64(stream, index) || index >= table.size())
+        return false;
+    symbol = table[index];
+    return true;
+}
+
+static void WriteSymbolSet(std::ostream& stream, const SymbolWriteTable& table, const SymbolSet& set)
+{
+    Serializer::WriteU64(stream, set.size());
+    for (Symbol symbol: set) {
+        WriteSymbolIndex(stream, table, symbol);
+    }
+}
+
+static bool ReadSymbolSet(std::istream& stream, const std::vector<Symbol>& table, SymbolSet& set)
+{
+    uint64_t count;
+    if (!Serializer::ReadU64(stream, count))
+        return false;
+    set.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        Symbol symbol;
+        if (!ReadSymbolIndex(stream, table, symbol))
+            return false;
+        set.insert(symbol);
+    }
+    return true;
+}
+
+// IR Functions
+static void WriteIRValues(std::ostream& stream, const SymbolWriteTable& table, const IRValues& irValues)
+{
+    Serializer::WriteU64(stream, (uint64_t)irValues.type);
+    Serializer::WriteU64(stream, irValues.values.size());
+    for (auto& instruction: irValues.values) {
+        Serializer::WriteU64(stream, (uint64_t)instruction.type);
+        Serializer::WriteU64(stream, (uint32_t)instruction.operand);
+        WriteSymbolIndex(stream, table, instruction.symbol);
+    }
+
+    Serializer::WriteU64(stream, irValues.assembly.size());
+    for (auto& block: irValues.assembly) {
+        Serializer::WriteU64(stream, block.size());
+        for (auto& string: block) {
+            Serializer::WriteString(stream, string);
+        }
+    }
+
+    Serializer::WriteU64(stream, irValues.line);
+    Serializer::WriteU64(stream, irValues.lines.size());
+    for (auto& [first, line]: irValues.lines) {
+        Serializer::WriteU64(stream, first);
+        Serializer::WriteU64(stream, line);
+    }
+}
+
+static bool ReadIRValues(std::istream& stream, const std::vector<Symbol>& table, IRValues& irValues)
+{
+    uint64_t type, count;
+    if (!Serializer::ReadU64(stream, type) || !Serializer::ReadU64(stream, count) || count > MAX_LENGTH)
+        return false;
+    irValues.type = (IRValuesType)type;
+    irValues.values.resize(count);
+    for (auto& instruction: irValues.values) {
+        uint64_t op, operand;
+        if (!Serializer::ReadU64(stream, op) ||
+            !Serializer::ReadU64(stream, operand) ||
+            !ReadSymbolIndex(stream, table, instruction.symbol))
+            return false;
+        instruction.type = (IRType)op;
+        instruction.operand = (int32_t)(uint32_t)operand;
+    }
+
+    if (!Serializer::ReadU64(stream, count) || count > MAX_LENGTH)
+        return false;
+    irValues.assembly.resize(count);
+    for (auto& block: irValues.assembly) {
+        uint64_t size;
+        if (!Serializer::ReadU64(stream, size) || size > MAX_LENGTH)
+            return false;
+        block.resize(size);
+        for (auto& string: block) {
+            if (!Serializer::ReadString(stream, string))
+                return false;
+        }
+    }
+
+    uint64_t line;
+    if (!Serializer::ReadU64(stream, line) || !Serializer::ReadU64(stream, count) || count > MAX_LENGTH)
+        return false;
+    irValues.line = (uint32_t)line;
+    irValues.lines.resize(count);
+    for (auto& entry: irValues.lines) {
+        uint64_t first;
+        if (!Serializer::ReadU64(stream, first) || !Serializer::ReadU64(stream, line))
+            return false;
+        entry = {(uint32_t)first, (uint32_t)line};
+    }
+    return true;
+}
+
+void Serializer::WriteIRInfo(std::ostream& stream, const IRInfo& irInfo)
+{
+    SymbolWriteTable table;
+    table.Add(Symbols::NONE);
+    for (auto& [name, global]: irInfo.globalsMap) {
+        table.Add(name);
+        for (auto& instruction: global.irValues.values) {
+            table.Add(instruction.symbol);
+        }
+        for (Symbol symbol: global.references) {
+            table.Add(symbol);
+        }
+    }
+    for (auto set: {&irInfo.globals, &irInfo.references, &irInfo.strings}) {
+        for (Symbol symbol: *set) {
+            table.Add(symbol);
+        }
+    }
+
+    WriteU64(stream, table.symbols.size());
+    for (Symbol symbol: table.symbols) {
+        WriteSymbol(stream, symbol);
+    }
+
+    WriteU64(stream, irInfo.globalsMap.size());
+    for (auto& [name, global]: irInfo.globalsMap) {
+        WriteSymbolIndex(stream, table, name);
+        WriteIRValues(stream, table, global.irValues);
+        WriteSymbolSet(stream, table, global.references);
+    }
+    WriteSymbolSet(stream, table, irInfo.globals);
+    WriteSymbolSet(stream, table, irInfo.references);
+    WriteSymbolSet(stream, table, irInfo.strings);
+    WriteString(stream, irInfo.sourceName);
+}
+
+bool Serializer::ReadIRInfo(std::istream& stream, IRInfo& irInfo)
+{
+    uint64_t count;
+    if (!ReadU64(stream, count) || count > MAX_LENGTH)
+        return false;
+    std::vector<Symbol> table(count);
+    for (Symbol& symbol: table) {
+        if (!ReadSymbol(stream, symbol))
+            return false;
+    }
+
+    if (!ReadU64(stream, count))
+        return false;
+    irInfo.globalsMap.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        Symbol name;
+        if (!ReadSymbolIndex(stream, table, name))
+            return false;
+        auto& global = irInfo.globalsMap[name];
+        if (!ReadIRValues(stream, table, global.irValues) || !ReadSymbolSet(stream, table, global.references))
+            return false;
+    }
+    return ReadSymbolSet(stream, table, irInfo.globals) &&
+           ReadSymbolSet(stream, table, irInfo.references) &&
+           ReadSymbolSet(stream, table, irInfo.strings) &&
+           ReadString(stream, irInfo.sourceName);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <iostream>
+#include <cstdint>
+
+// Binary encoding of IRInfo, used by the library IR cache and object modules
+namespace Serializer
+{
+    uint64_t Hash(std::string_view data);
+    void WriteIRInfo(std::ostream& stream, const IRInfo& irInfo);
+    bool ReadIRInfo(std::istream& stream, IRInfo& irInfo);
+
+    void WriteU64(std::ostream& stream, uint64_t value);
+    bool ReadU64(std::istream& stream, uint64_t& value);
+    void WriteString(std::ostream& stream, const std::string& string);
+    bool ReadString(std::istream& stream, std::string& string);
+    void WriteSymbol(std::ostream& stream, Symbol symbol);
+    bool ReadSymbol(std::istream& stream, Symbol& symbol);
+}
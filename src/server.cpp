@@ -0,0 +1,220 @@
+#include "server.hpp"
+#include "diagnostics.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifndef _WIN32
+
+// Bounds a request so a confused client cannot make the server allocate without limit
+static constexpr uint64_t MAX_MESSAGE = 1 << 24;
+
+// Wire Functions, every value is a little endian u64 or a length prefixed string
+static bool SendAll(int socket, const char* data, size_t size)
+{
+    while (size) {
+        ssize_t sent = send(socket, data, size, 0);
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool ReceiveAll(int socket, char* data, size_t size)
+{
+    while (size) {
+        ssize_t received = recv(socket, data, size, 0);
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool SendU64(int socket, uint64_t value)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = (char)(value >> (i * 8));
+    }
+    return SendAll(socket, bytes, sizeof(bytes));
+}
+
+static bool ReceiveU64(int socket, uint64_t& value)
+{
+    unsigned char bytes[8];
+    if (!ReceiveAll(socket, (char*)bytes, sizeof(bytes)))
+        return false;
+    value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+    return true;
+}
+
+static bool SendString(int socket, const std::string& string)
+{
+    return SendU64(socket, string.size()) && SendAll(socket, string.data(), string.size());
+}
+
+static bool ReceiveString(int socket, std::string& string)
+{
+    uint64_t size;
+    if (!ReceiveU64(socket, size) || size > MAX_MESSAGE)
+        return false;
+    string.resize(size);
+    return ReceiveAll(socket, string.data(), size);
+}
+
+static bool MakeAddress(const std::string& socketPath, sockaddr_un& address)
+{
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "[FATAL ERROR]: socket path '" << socketPath << "' is too long\n";
+        return false;
+    }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+// Runs one request from the client's directory with its output captured
+static void HandleClient(int client, const Server::CompileFunction& compile)
+{
+    std::string directory;
+    uint64_t count;
+    if (!ReceiveString(client, directory) || !ReceiveU64(client, count) || count > MAX_MESSAGE)
+        return;
+    std::vector<std::string> args(count);
+    for (auto& arg: args) {
+        if (!ReceiveString(client, arg))
+            return;
+    }
+
+    int status = 1;
+    std::string output;
+    std::error_code error;
+    fs::path serverDirectory = fs::current_path();
+    {
+        Diagnostics::Capture capture;
+        fs::current_path(directory, error);
+        if (error) {
+            std::cerr << "[FATAL ERROR]: compile server could not enter '" << directory << "'\n";
+        } else {
+            try {
+                status = compile(args);
+            } catch (const std::exception& e) {
+                std::cerr << "[FATAL ERROR]: " << e.what() << '\n';
+                std::cerr << "Compilation Terminated.";
+            }
+        }
+        output = capture.Text();
+    }
+    fs::current_path(serverDirectory, error);
+
+    SendU64(client, (uint64_t)status);
+    SendString(client, output);
+}
+
+int Server::Serve(const std::string& socketPath, const CompileFunction& compile)
+{
+    sockaddr_un address;
+    if (!MakeAddress(socketPath, address))
+        return 1;
+
+    // a client that hangs up early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "[FATAL ERROR]: could not listen on '" << socketPath << "': " << std::strerror(errno) << '\n';
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+    std::cout << "[SERVER]: listening on " << socketPath << std::endl;
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "[FATAL ERROR]: accept failed: " << std::strerror(errno) << '\n';
+            break;
+        }
+        HandleClient(client, compile);
+        close(client);
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    return 1;
+}
+
+int Server::Connect(const std::string& socketPath, const std::vector<std::string>& args)
+{
+    sockaddr_un address;
+    if (!MakeAddress(socketPath, address))
+        return 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (sockaddr*)&address, sizeof(address)) != 0) {
+        std::cerr << "[FATAL ERROR]: could not connect to compile server at '" << socketPath << "'\n";
+        std::cerr << "Compilation Terminated.";
+        if (server >= 0) {
+            close(server);
+        }
+        return 1;
+    }
+
+    bool sent = SendString(server, fs::current_path().string()) && SendU64(server, args.size());
+    for (size_t i = 0; sent && i < args.size(); ++i) {
+        sent = SendString(server, args[i]);
+    }
+
+    uint64_t status;
+    std::string output;
+    if (!sent || !ReceiveU64(server, status) || !ReceiveString(server, output)) {
+        std::cerr << "[FATAL ERROR]: compile server at '" << socketPath << "' dropped the request\n";
+        std::cerr << "Compilation Terminated.";
+        close(server);
+        return 1;
+    }
+    close(server);
+
+    std::cerr << output;
+    return (int)status;
+}
+
+#else
+
+int Server::Serve(const std::string& socketPath, const CompileFunction& compile)
+{
+    std::cerr << "[FATAL ERROR]: the compile server needs Unix domain sockets\n";
+    return 1;
+}
+
+int Server::Connect(const std::string& socketPath, const std::vector<std::string>& args)
+{
+    std::cerr << "[FATAL ERROR]: the compile server needs Unix domain sockets\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// Resident compile server. Clients send their working directory and the arguments they would have
+// passed to bcc, and get back the exit status and everything the compile printed
+namespace Server
+{
+    static constexpr const char* DEFAULT_SOCKET = "/tmp/bcc.sock";
+
+    using CompileFunction = std::function<int(const std::vector<std::string>& args)>;
+
+    // serves requests one at a time until killed, each one runs `compile` with std::cout and std::cerr captured
+    int Serve(const std::string& socketPath, const CompileFunction& compile);
+    // forwards one compile to the server and returns its status
+    int Connect(const std::string& socketPath, const std::vector<std::string>& args);
+}
@@ -0,0 +1,74 @@
+#include "symbol.hpp"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Strings live in a deque so the views used as keys stay valid while it grows
+struct SymbolTable
+{
+    std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Symbol> ids;
+
+    SymbolTable()
+    {
+        // the code generator caches these in statics, interning them first keeps them below any Release
+        for (const char* name: {"?", "bp", "sp"}) {
+            names.emplace_back(name);
+            ids.emplace(names.back(), (Symbol)names.size() - 1);
+        }
+    }
+};
+
+static SymbolTable& GetTable()
+{
+    static SymbolTable table;
+    return table;
+}
+
+Symbol Symbols::Intern(std::string_view name)
+{
+    SymbolTable& table = GetTable();
+    {
+        std::shared_lock<std::shared_mutex> lock(table.mutex);
+        auto found = table.ids.find(name);
+        if (found != table.ids.end())
+            return found->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    auto found = table.ids.find(name);
+    if (found != table.ids.end())
+        return found->second;
+
+    Symbol symbol = (Symbol)table.names.size();
+    table.names.emplace_back(name);
+    table.ids.emplace(table.names.back(), symbol);
+    return symbol;
+}
+
+const std::string& Symbols::Name(Symbol symbol)
+{
+    SymbolTable& table = GetTable();
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    return table.names[symbol];
+}
+
+size_t Symbols::Count()
+{
+    SymbolTable& table = GetTable();
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    return table.names.size();
+}
+
+void Symbols::Release(size_t count)
+{
+    SymbolTable& table = GetTable();
+    std::unique_lock<std::shared_mutex> lock(table.mutex);
+    while (table.names.size() > count && table.names.size() > 1) {
+        table.ids.erase(table.names.back());
+        table.names.pop_back();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+
+using Symbol = uint32_t;
+
+// Process-wide string interner, identifiers, globals and string literals are passed around as ids
+namespace Symbols
+{
+    // symbol 0 is reserved for "?", the name used outside of any global
+    constexpr Symbol NONE = 0;
+
+    Symbol Intern(std::string_view name);
+    const std::string& Name(Symbol symbol);
+
+    // Lets a resident process bound the table, Release forgets every symbol interned after Count
+    // returned `count`. Nothing may still hold one of those ids, and nothing may intern meanwhile
+    size_t Count();
+    void Release(size_t count);
+}
+
+// Set of symbols that iterates in insertion order, so anything emitted from it follows the source
+// and not the interning order, which changes with -j. Mirrors the std::unordered_set calls it replaces
+class SymbolSet
+{
+public:
+    using const_iterator = std::vector<Symbol>::const_iterator;
+
+    bool insert(Symbol symbol)
+    {
+        if (!m_index.insert(symbol).second)
+            return false;
+        m_order.push_back(symbol);
+        return true;
+    }
+
+    template<typename Iterator>
+    void insert(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    bool emplace(Symbol symbol) { return insert(symbol); }
+    size_t count(Symbol symbol) const { return m_index.count(symbol); }
+    size_t size() const { return m_order.size(); }
+    bool empty() const { return m_order.empty(); }
+    void clear() { m_index.clear(); m_order.clear(); }
+
+    // drops everything inserted after the first `count` symbols
+    void truncate(size_t count)
+    {
+        for (size_t i = count; i < m_order.size(); ++i) {
+            m_index.erase(m_order[i]);
+        }
+        if (count < m_order.size()) {
+            m_order.resize(count);
+        }
+    }
+
+    const_iterator begin() const { return m_order.begin(); }
+    const_iterator end() const { return m_order.end(); }
+
+private:
+    std::unordered_set<Symbol> m_index;
+    std::vector<Symbol> m_order;
+};
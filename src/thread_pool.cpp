@@ -0,0 +1,82 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    m_running = 0;
+    m_stopping = false;
+
+    workers = Workers(workers);
+    if (workers <= 1)
+        return;
+    for (size_t i = 0; i < workers; ++i) {
+        try {
+            m_workers.emplace_back([this] { WorkerLoop(); });
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+}
+
+size_t ThreadPool::Workers(size_t requested)
+{
+    return std::max<size_t>(std::min<size_t>(requested, std::thread::hardware_concurrency()), 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobReady.notify_all();
+    for (auto& worker: m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    if (m_workers.empty()) {
+        job();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobReady.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobsDone.wait(lock, [this] { return m_jobs.empty() && m_running == 0; });
+}
+
+// Worker Functions
+void ThreadPool::WorkerLoop()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobReady.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_running += 1;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running -= 1;
+        }
+        m_jobsDone.notify_all();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+class ThreadPool
+{
+public:
+    // workers <= 1 runs every job inline on the calling thread, past Workers the rest are not started
+    // and neither are any the system refuses to create
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    // the workers a pool asked for `requested` starts at most, one per core and one when the core count is unknown
+    static size_t Workers(size_t requested);
+
+    void Submit(std::function<void()> job);
+    void Wait();
+
+private:
+    // Pool Info
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_jobsDone;
+    size_t m_running;
+    bool m_stopping;
+
+    // Worker Functions
+    void WorkerLoop();
+};
@@ -0,0 +1,102 @@
+#include "top_level.hpp"
+
+#include <algorithm>
+
+// Token Skipping, mirrors the statement shapes IRGenerator::GenStmt accepts
+static size_t SkipBalanced(const std::vector<Token>& tokens, size_t i, TokenType open, TokenType close, bool& complete)
+{
+    if (tokens[i].type != open)
+        return i;
+
+    size_t depth = 0;
+    while (tokens[i].type != TokenType::END_OF_FILE) {
+        TokenType type = tokens[i++].type;
+        if (type == open) {
+            depth += 1;
+        } else if (type == close && --depth == 0) {
+            return i;
+        }
+    }
+    complete = false;
+    return i;
+}
+
+static size_t SkipStatement(const std::vector<Token>& tokens, size_t i, bool& complete)
+{
+    switch (tokens[i].type) {
+        case TokenType::END_OF_FILE:
+            complete = false;
+            return i;
+        case TokenType::OPENBRACE:
+            i = SkipBalanced(tokens, i, TokenType::OPENBRACE, TokenType::CLOSEBRACE, complete);
+            break;
+        case TokenType::ASM:
+            i = SkipBalanced(tokens, i + 1, TokenType::OPENBRACE, TokenType::CLOSEBRACE, complete);
+            break;
+        case TokenType::IF:
+            i = SkipBalanced(tokens, i + 1, TokenType::OPENPAREN, TokenType::CLOSEPAREN, complete);
+            i = SkipStatement(tokens, i, complete);
+            if (tokens[i].type == TokenType::ELSE) {
+                i = SkipStatement(tokens, i + 1, complete);
+            }
+            return i;
+        case TokenType::WHILE:
+            i = SkipBalanced(tokens, i + 1, TokenType::OPENPAREN, TokenType::CLOSEPAREN, complete);
+            return SkipStatement(tokens, i, complete);
+        default:
+            if (tokens[i].type == TokenType::IDENT && tokens[i + 1].type == TokenType::COLON) {
+                i += 2;
+                break;
+            }
+            while (tokens[i].type != TokenType::SEMICOLON && tokens[i].type != TokenType::END_OF_FILE) {
+                if (tokens[i].type == TokenType::OPENPAREN) {
+                    i = SkipBalanced(tokens, i, TokenType::OPENPAREN, TokenType::CLOSEPAREN, complete);
+                } else if (tokens[i].type == TokenType::OPENBRACE) {
+                    i = SkipBalanced(tokens, i, TokenType::OPENBRACE, TokenType::CLOSEBRACE, complete);
+                } else {
+                    i += 1;
+                }
+            }
+            if (tokens[i].type == TokenType::END_OF_FILE) {
+                complete = false;
+            }
+            break;
+    }
+    while (tokens[i].type == TokenType::SEMICOLON) {
+        i += 1;
+    }
+    return i;
+}
+
+std::vector<TopLevel::Item> TopLevel::Split(const std::vector<Token>& tokens)
+{
+    std::vector<Item> items;
+    size_t i = 0;
+    while (tokens[i].type != TokenType::END_OF_FILE) {
+        TokenType first = tokens[i].type;
+        TokenType next = tokens[i + 1].type;
+        bool definition = first == TokenType::IDENT && (
+            next == TokenType::OPENPAREN ||
+            next == TokenType::ASM ||
+            next == TokenType::EQUAL
+        );
+
+        bool complete = true;
+        size_t start = i;
+        if (!definition) {
+            i = std::max(SkipStatement(tokens, i, complete), i + 1);
+        } else if (next == TokenType::OPENPAREN) {
+            i = SkipBalanced(tokens, i + 1, TokenType::OPENPAREN, TokenType::CLOSEPAREN, complete);
+            i = SkipStatement(tokens, i, complete);
+        } else {
+            i = SkipStatement(tokens, i + 1, complete);
+        }
+
+        // a string or comment left open swallows everything after it
+        for (size_t token = start; token < i && complete; ++token) {
+            complete = tokens[token].type != TokenType::UNTERMINATED_STRING && tokens[token].type != TokenType::UNTERMINATED_COMMENT;
+        }
+        items.push_back({start, i, definition, complete});
+    }
+    return items;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "lexer.hpp"
+
+// Splits tokens into top-level statements the way IRGenerator::GenStmt consumes them, without
+// generating anything. The library indexes its files with it and incremental reparsing uses it
+// to find the definitions an edit touched
+namespace TopLevel
+{
+    struct Item
+    {
+        size_t first, last; // token range, last is one past the item
+        bool definition;    // function, asm function or global variable
+        bool complete;      // false when the item ran into the end of the tokens
+    };
+
+    std::vector<Item> Split(const std::vector<Token>& tokens);
+}
@@ -0,0 +1,391 @@
+#include "tree_selector.hpp"
+
+#include <algorithm>
+
+// r1 holds return values and r20 is bp, trees are computed in the registers between
+static constexpr int32_t FIRST_REGISTER = 2;
+static constexpr int32_t LAST_REGISTER = 19;
+static constexpr uint32_t REGISTERS = LAST_REGISTER - FIRST_REGISTER + 1;
+static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+static Operand BP()
+{
+    static const Operand bp = Operand::Named(Symbols::Intern("bp"));
+    return bp;
+}
+
+static bool IsComparison(Opcode opcode)
+{
+    switch (opcode) {
+        case Opcode::SETL:
+        case Opcode::SETLE:
+        case Opcode::SETG:
+        case Opcode::SETGE:
+        case Opcode::SETE:
+        case Opcode::SETNE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+TreeSelector::TreeSelector(MachineProgram& program)
+    : m_program(program)
+{
+    m_materialized = 0;
+    m_poppedEnd = FIRST_REGISTER;
+}
+
+void TreeSelector::Reset()
+{
+    m_nodes.clear();
+    m_stack.clear();
+    m_materialized = 0;
+}
+
+uint32_t TreeSelector::AddNode(Kind kind, Opcode opcode, uint32_t left, uint32_t right, uint32_t need)
+{
+    m_nodes.push_back({kind, opcode, {}, 0, left, right, need, m_program.Line()});
+    return m_nodes.size() - 1;
+}
+
+// a value nothing pushed was put there by code the selector did not see, so it is on the real stack
+uint32_t TreeSelector::Pop()
+{
+    if (m_stack.empty())
+        return AddNode(Kind::STACKED, Opcode::NOP, NO_NODE, NO_NODE, 0);
+    uint32_t index = m_stack.back();
+    m_stack.pop_back();
+    m_materialized = std::min(m_materialized, m_stack.size());
+    return index;
+}
+
+// Tree Functions
+void TreeSelector::PushValue(Operand value)
+{
+    uint32_t index = AddNode(Kind::VALUE, Opcode::NOP, NO_NODE, NO_NODE, 0);
+    m_nodes[index].value = value;
+    m_stack.push_back(index);
+}
+
+void TreeSelector::PushLocal(int32_t offset)
+{
+    uint32_t index = AddNode(Kind::LOCAL, Opcode::LLOD, NO_NODE, NO_NODE, 1);
+    m_nodes[index].offset = offset;
+    m_stack.push_back(index);
+}
+
+void TreeSelector::PushAddress(int32_t offset)
+{
+    uint32_t index = AddNode(Kind::ADDRESS, Opcode::ADD, NO_NODE, NO_NODE, 1);
+    m_nodes[index].offset = offset;
+    m_stack.push_back(index);
+}
+
+void TreeSelector::PushReturned()
+{
+    uint32_t index = AddNode(Kind::RETURNED, Opcode::NOP, NO_NODE, NO_NODE, 0);
+    m_nodes[index].value = Operand::Register(1);
+    m_stack.push_back(index);
+}
+
+void TreeSelector::Apply(Opcode opcode)
+{
+    uint32_t right = Pop();
+    uint32_t left = Pop();
+    uint32_t leftNeed = m_nodes[left].need, rightNeed = m_nodes[right].need;
+    uint32_t need = leftNeed == rightNeed ? leftNeed + 1 : std::max(leftNeed, rightNeed);
+    m_stack.push_back(AddNode(Kind::BINARY, opcode, left, right, need));
+}
+
+void TreeSelector::Not()
+{
+    uint32_t child = Pop();
+    m_stack.push_back(AddNode(Kind::UNARY, Opcode::NOT, child, NO_NODE, std::max(m_nodes[child].need, 1u)));
+}
+
+void TreeSelector::Deref()
+{
+    uint32_t child = Pop();
+    m_stack.push_back(AddNode(Kind::UNARY, Opcode::LOD, child, NO_NODE, std::max(m_nodes[child].need, 1u)));
+}
+
+// Selection Functions
+void TreeSelector::StoreLocal(int32_t offset)
+{
+    uint32_t line = m_program.Line();
+    int32_t reg = Prepare(1);
+    Operand value = Generate(Pop(), reg);
+    m_program.SetLine(line);
+    m_program.Emit(Opcode::LSTR, BP(), Operand::Immediate(offset), value);
+}
+
+void TreeSelector::StoreMemory()
+{
+    uint32_t line = m_program.Line();
+    int32_t reg = Prepare(2);
+    uint32_t value = Pop();
+    uint32_t address = Pop();
+    Operand base, offset;
+    GenerateAddress(address, reg, base, offset);
+    Operand result = Generate(value, reg);
+    m_program.SetLine(line);
+    if (offset.kind == OperandKind::NONE) {
+        m_program.Emit(Opcode::STR, base, result);
+    } else {
+        m_program.Emit(Opcode::LSTR, base, offset, result);
+    }
+}
+
+// Conditions branch on the comparison itself, a constant one is a jump or nothing at all
+void TreeSelector::BranchIfFalse(uint32_t label)
+{
+    uint32_t line = m_program.Line();
+    int32_t reg = Prepare(1);
+    uint32_t index = Pop();
+    Node node = m_nodes[index];
+    Operand target = Operand::Label(label);
+    Operand a, b;
+
+    if (node.kind == Kind::BINARY && IsComparison(node.opcode)) {
+        GenerateOperands(node.left, node.right, reg, a, b);
+        m_program.SetLine(line);
+        m_program.Emit(MachineProgram::ComparisonBranch(node.opcode, false), target, a, b);
+    } else if (node.kind == Kind::UNARY && node.opcode == Opcode::NOT && m_nodes[node.left].kind == Kind::BINARY && IsComparison(m_nodes[node.left].opcode)) {
+        // not of a comparison is zero exactly when the comparison holds
+        GenerateOperands(m_nodes[node.left].left, m_nodes[node.left].right, reg, a, b);
+        m_program.SetLine(line);
+        m_program.Emit(MachineProgram::ComparisonBranch(m_nodes[node.left].opcode, true), target, a, b);
+    } else if (node.kind == Kind::UNARY && node.opcode == Opcode::NOT) {
+        // not is bitwise, so only an all ones operand makes it zero
+        a = Generate(node.left, reg);
+        m_program.SetLine(line);
+        m_program.Emit(Opcode::BRE, target, a, Operand::Immediate(0xFFFF));
+    } else if (node.kind == Kind::VALUE && node.value.kind == OperandKind::IMMEDIATE) {
+        // words are 16 bits, so a constant is false whenever its low 16 bits are zero
+        m_program.SetLine(line);
+        if ((uint16_t)node.value.value == 0) {
+            m_program.Emit(Opcode::JMP, target);
+        }
+    } else {
+        a = Generate(index, reg);
+        m_program.SetLine(line);
+        m_program.Emit(Opcode::BRZ, target, a);
+    }
+}
+
+void TreeSelector::PopInto(Operand target)
+{
+    uint32_t line = m_program.Line();
+    if (!m_stack.empty() && m_nodes[m_stack.back()].kind == Kind::STACKED) {
+        Pop();
+        m_program.Emit(Opcode::POP, target);
+        return;
+    }
+    int32_t reg = Prepare(1);
+    Operand value = Generate(Pop(), reg, target);
+    m_program.SetLine(line);
+    if (value != target) {
+        m_program.Emit(value.IsRegister() ? Opcode::MOV : Opcode::IMM, target, value);
+    }
+}
+
+void TreeSelector::Flush()
+{
+    uint32_t line = m_program.Line();
+    Materialize(m_stack.size());
+    m_program.SetLine(line);
+}
+
+void TreeSelector::Drop(size_t count)
+{
+    m_stack.resize(m_stack.size() - std::min(count, m_stack.size()));
+    m_materialized = std::min(m_materialized, m_stack.size());
+}
+
+// Pushes the values below `count` and pops the stacked values the top `count` trees read into registers,
+// returns the first register left for computing them. Trees too big for the registers go through the stack
+int32_t TreeSelector::Prepare(size_t count)
+{
+    while (m_stack.size() < count) {
+        m_stack.insert(m_stack.begin(), AddNode(Kind::STACKED, Opcode::NOP, NO_NODE, NO_NODE, 0));
+        m_materialized += 1;
+    }
+    size_t first = m_stack.size() - count;
+    Materialize(first);
+
+    m_popped.clear();
+    uint32_t need = 0;
+    for (size_t i = first; i < m_stack.size(); ++i) {
+        CollectStacked(m_stack[i]);
+        need += m_nodes[m_stack[i]].need;
+    }
+    if (m_popped.size() + need > REGISTERS) {
+        m_popped.clear();
+        for (size_t i = first; i < m_stack.size(); ++i) {
+            EmitStackCode(m_stack[i]);
+            m_stack[i] = AddNode(Kind::STACKED, Opcode::NOP, NO_NODE, NO_NODE, 0);
+            m_popped.push_back(m_stack[i]);
+        }
+    }
+    return PopStacked();
+}
+
+void TreeSelector::Materialize(size_t end)
+{
+    for (size_t i = m_materialized; i < end; ++i) {
+        uint32_t index = m_stack[i];
+        if (m_nodes[index].kind == Kind::STACKED)
+            continue;
+
+        m_popped.clear();
+        CollectStacked(index);
+        if (m_popped.size() + m_nodes[index].need > REGISTERS) {
+            EmitStackCode(index);
+        } else {
+            int32_t reg = PopStacked();
+            Operand value = Generate(index, reg);
+            m_program.SetLine(m_nodes[index].line);
+            m_program.Emit(Opcode::PSH, value);
+        }
+        m_stack[i] = AddNode(Kind::STACKED, Opcode::NOP, NO_NODE, NO_NODE, 0);
+    }
+    m_materialized = std::max(m_materialized, end);
+}
+
+// stacked leaves come before every other leaf, in the order they were pushed
+void TreeSelector::CollectStacked(uint32_t index)
+{
+    const Node& node = m_nodes[index];
+    if (node.kind == Kind::STACKED) {
+        m_popped.push_back(index);
+    } else if (node.kind == Kind::UNARY) {
+        CollectStacked(node.left);
+    } else if (node.kind == Kind::BINARY) {
+        CollectStacked(node.left);
+        CollectStacked(node.right);
+    }
+}
+
+int32_t TreeSelector::PopStacked()
+{
+    for (size_t i = m_popped.size(); i-- > 0;) {
+        Operand reg = Operand::Register(FIRST_REGISTER + (int32_t)i);
+        m_nodes[m_popped[i]].value = reg;
+        m_program.Emit(Opcode::POP, reg);
+    }
+    m_poppedEnd = FIRST_REGISTER + (int32_t)m_popped.size();
+    return m_poppedEnd;
+}
+
+static bool IsPopped(const Operand& operand, int32_t poppedEnd)
+{
+    return operand.IsRegister() && operand.value >= FIRST_REGISTER && operand.value < poppedEnd;
+}
+
+// Computes a tree into `target`, or else into a popped operand it reads last or the next free register,
+// which `reg` then moves past. Leaves are operands already and emit nothing
+Operand TreeSelector::Generate(uint32_t index, int32_t& reg, Operand target)
+{
+    Node node = m_nodes[index];
+    int32_t first = reg;
+    Opcode opcode = node.opcode;
+    Operand a, b;
+
+    switch (node.kind) {
+        case Kind::VALUE:
+        case Kind::RETURNED:
+        case Kind::STACKED:
+            return node.value;
+        case Kind::LOCAL:
+        case Kind::ADDRESS:
+            a = BP();
+            b = Operand::Immediate(node.offset);
+            break;
+        case Kind::UNARY:
+            if (opcode == Opcode::LOD) {
+                GenerateAddress(node.left, reg, a, b);
+                opcode = b.kind == OperandKind::NONE ? Opcode::LOD : Opcode::LLOD;
+            } else {
+                a = Generate(node.left, reg);
+            }
+            break;
+        case Kind::BINARY:
+            GenerateOperands(node.left, node.right, reg, a, b);
+            break;
+    }
+
+    reg = first;
+    Operand dest = target;
+    if (dest.kind == OperandKind::NONE) {
+        dest = IsPopped(a, m_poppedEnd) ? a : IsPopped(b, m_poppedEnd) ? b : Operand::Register(reg++);
+    }
+    m_program.SetLine(node.line);
+    m_program.Emit(opcode, dest, a, b);
+    return dest;
+}
+
+// the operand needing more registers goes first, so its result is all the other one has to keep clear of
+void TreeSelector::GenerateOperands(uint32_t left, uint32_t right, int32_t& reg, Operand& a, Operand& b)
+{
+    if (m_nodes[right].need > m_nodes[left].need) {
+        b = Generate(right, reg);
+        a = Generate(left, reg);
+    } else {
+        a = Generate(left, reg);
+        b = Generate(right, reg);
+    }
+}
+
+// bp relative addresses and sums fold into llod/lstr, `offset` stays empty for plain lod/str
+void TreeSelector::GenerateAddress(uint32_t index, int32_t& reg, Operand& base, Operand& offset)
+{
+    const Node& node = m_nodes[index];
+    if (node.kind == Kind::ADDRESS) {
+        base = BP();
+        offset = Operand::Immediate(node.offset);
+    } else if (node.kind == Kind::BINARY && node.opcode == Opcode::ADD) {
+        GenerateOperands(node.left, node.right, reg, base, offset);
+    } else {
+        base = Generate(index, reg);
+        offset = {};
+    }
+}
+
+// The plain stack lowering of one tree, whose stacked leaves are already in place
+void TreeSelector::EmitStackCode(uint32_t index)
+{
+    static const Operand R2 = Operand::Register(2);
+    static const Operand R3 = Operand::Register(3);
+    Node node = m_nodes[index];
+
+    switch (node.kind) {
+        case Kind::STACKED:
+            return;
+        case Kind::VALUE:
+        case Kind::RETURNED:
+            m_program.SetLine(node.line);
+            m_program.Emit(Opcode::PSH, node.value);
+            return;
+        case Kind::LOCAL:
+        case Kind::ADDRESS:
+            m_program.SetLine(node.line);
+            m_program.Emit(node.opcode, R2, BP(), Operand::Immediate(node.offset));
+            break;
+        case Kind::UNARY:
+            EmitStackCode(node.left);
+            m_program.SetLine(node.line);
+            m_program.Emit(Opcode::POP, R2);
+            m_program.Emit(node.opcode, R2, R2);
+            break;
+        case Kind::BINARY:
+            EmitStackCode(node.left);
+            EmitStackCode(node.right);
+            m_program.SetLine(node.line);
+            m_program.Emit(Opcode::POP, R3);
+            m_program.Emit(Opcode::POP, R2);
+            m_program.Emit(node.opcode, R2, R2, R3);
+            break;
+    }
+    m_program.Emit(Opcode::PSH, R2);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "machine_ir.hpp"
+
+#include <vector>
+#include <cstdint>
+
+// Instruction selection over expression trees rebuilt from the stack IR. Operators without side effects
+// only build trees on a virtual stack, the instruction that consumes a value matches its tree against
+// the patterns below and computes it in registers. Everything else first pushes the values still pending,
+// in stack order, so the real stack always looks the way the plain stack lowering leaves it
+class TreeSelector
+{
+public:
+    explicit TreeSelector(MachineProgram& program);
+
+    // forgets every value, at the start of a function
+    void Reset();
+
+    // Tree Functions, leaves and operators over the values on top
+    void PushValue(Operand value);
+    void PushLocal(int32_t offset);
+    void PushAddress(int32_t offset);
+    // r1 right after a call, pushed before anything else may use r1
+    void PushReturned();
+    void Apply(Opcode opcode);
+    void Not();
+    void Deref();
+
+    // Selection Functions, each consumes the values it names
+    void StoreLocal(int32_t offset);
+    // the address below the value
+    void StoreMemory();
+    void BranchIfFalse(uint32_t label);
+    void PopInto(Operand target);
+
+    // pushes every pending value onto the real stack
+    void Flush();
+    // values popped off the real stack by code the selector did not emit
+    void Drop(size_t count);
+
+private:
+    enum class Kind : uint8_t
+    {
+        VALUE,    // an immediate or label operand
+        LOCAL,    // llod from bp
+        ADDRESS,  // bp plus an offset
+        RETURNED, // r1
+        STACKED,  // already on the real stack, popped into a register before the tree is computed
+        UNARY,    // not or lod
+        BINARY,
+    };
+
+    struct Node
+    {
+        Kind kind;
+        Opcode opcode;
+        Operand value; // VALUE, RETURNED, and the register a STACKED value was popped into
+        int32_t offset;
+        uint32_t left, right;
+        uint32_t need; // registers computing it takes, Sethi-Ullman numbering
+        uint32_t line;
+    };
+
+    // Selector Info
+    MachineProgram& m_program;
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_stack;
+    size_t m_materialized; // entries below are all on the real stack
+    std::vector<uint32_t> m_popped;
+    int32_t m_poppedEnd; // registers from r2 up to here hold popped values, each read once
+
+    uint32_t AddNode(Kind kind, Opcode opcode, uint32_t left, uint32_t right, uint32_t need);
+    uint32_t Pop();
+
+    // Selection Functions
+    int32_t Prepare(size_t count);
+    void Materialize(size_t end);
+    void CollectStacked(uint32_t index);
+    int32_t PopStacked();
+    Operand Generate(uint32_t index, int32_t& reg, Operand target = {});
+    void GenerateOperands(uint32_t left, uint32_t right, int32_t& reg, Operand& a, Operand& b);
+    void GenerateAddress(uint32_t index, int32_t& reg, Operand& base, Operand& offset);
+    void EmitStackCode(uint32_t index);
+};
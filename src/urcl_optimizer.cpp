@@ -1,311 +1,666 @@
-
 #include "urcl_optimizer.hpp"
 
-#include <sstream>
-#include <unordered_set>
-
-static std::unordered_set<std::string> g_binops = {
-    "add", "sub", "mlt", "div", "mod",
-    "setl", "setg", "setge", "setle", "sete", "setne",
-    "brg", "ble", "bre", "bge", "brl", "bne"
-};
+static constexpr uint32_t NO_INSTRUCTION = UINT32_MAX;
+static constexpr size_t MAX_WINDOW = 3;
 
-void replaceAll(std::string& str, const std::string& from, const std::string& to) {
-    if (from.empty()) return; // avoid infinite loop
-    size_t pos = 0;
-    while ((pos = str.find(from, pos)) != std::string::npos) {
-        str.replace(pos, from.length(), to);
-        pos += to.length(); // move past replacement
+bool IsBinop(Opcode opcode)
+{
+    switch (opcode) {
+        case Opcode::ADD: case Opcode::SUB: case Opcode::MLT: case Opcode::DIV: case Opcode::MOD:
+        case Opcode::SETL: case Opcode::SETG: case Opcode::SETGE: case Opcode::SETLE: case Opcode::SETE: case Opcode::SETNE:
+        case Opcode::BRG: case Opcode::BLE: case Opcode::BRE: case Opcode::BGE: case Opcode::BRL: case Opcode::BNE:
+            return true;
+        default:
+            return false;
     }
 }
 
-bool IsBinop(const std::string& value) 
-{
-    return g_binops.count(value);
-}
+static const std::vector<Opcode> g_binops = {
+    Opcode::ADD, Opcode::SUB, Opcode::MLT, Opcode::DIV, Opcode::MOD,
+    Opcode::SETL, Opcode::SETG, Opcode::SETGE, Opcode::SETLE, Opcode::SETE, Opcode::SETNE,
+    Opcode::BRG, Opcode::BLE, Opcode::BRE, Opcode::BGE, Opcode::BRL, Opcode::BNE
+};
 
-// Source Functions
-bool URCLOptimizer::NotEnd() 
+// Remark Functions, instructions read the way they print except that labels are not numbered yet
+static std::string Describe(const MachineInstruction& instruction)
 {
-    return m_index < m_source.size();
+    std::string text = instruction.opcode == Opcode::RAW ? Symbols::Name(instruction.text) : MachineProgram::OpcodeName(instruction.opcode);
+    for (size_t i = 0; i < instruction.count; ++i) {
+        const Operand& operand = instruction.ops[i];
+        text += ' ';
+        switch (operand.kind) {
+            case OperandKind::REGISTER:
+                text += 'r' + std::to_string(operand.value);
+                break;
+            case OperandKind::IMMEDIATE:
+                text += std::to_string(operand.value);
+                break;
+            case OperandKind::LABEL:
+                text += "<label>";
+                break;
+            case OperandKind::NAMED:
+                text += Symbols::Name(operand.symbol);
+                break;
+            case OperandKind::NONE:
+                break;
+        }
+    }
+    return text;
 }
 
-void URCLOptimizer::Advance(int i)
+static std::string DescribeAll(const MachineInstruction* instructions, size_t count)
 {
-    m_index += i;
+    std::string text;
+    for (size_t i = 0; i < count; ++i) {
+        text += (i ? ", '" : "'") + Describe(instructions[i]) + "'";
+    }
+    return text;
 }
 
-std::vector<std::string>& URCLOptimizer::EatInstruction()
+static bool UsesStackPointer(const MachineInstruction& instruction)
 {
-    if (!NotEnd()) 
-        return m_dummy;
-    return m_source[m_index++];
+    static const Symbol sp = Symbols::Intern("sp");
+    for (size_t i = 0; i < instruction.count; ++i) {
+        if (instruction.ops[i].kind == OperandKind::NAMED && instruction.ops[i].symbol == sp)
+            return true;
+    }
+    return false;
 }
 
-std::vector<std::string>& URCLOptimizer::RequestInstruction(int i)
+// A psh and a pop one instruction apart are a plain copy made before it, unless it moves sp, calls
+// something that may clobber any register, or touches the popped register itself
+static bool KeepsStackPair(const MachineInstruction& between, const Operand& popped)
 {
-    if (m_index + i >= m_source.size())
-        return m_dummy;
-    return m_source[m_index+i];
+    switch (between.opcode) {
+        case Opcode::PSH: case Opcode::POP: case Opcode::CAL: case Opcode::RAW:
+            return false;
+        default:
+            break;
+    }
+    if (UsesStackPointer(between))
+        return false;
+    for (size_t i = 0; i < between.count; ++i) {
+        if (between[i] == popped)
+            return false;
+    }
+    return true;
 }
 
-// Initial Functions
-void URCLOptimizer::SliceAssembly(const std::string& assembly)
-{
-    std::stringstream ss(assembly);
-    std::string line;
+// Peephole Rules, tried in table order for each leading opcode
+static const PeepholeRule g_rules[] = {
+    // set<cc> then brz on its result branches on the inverted condition directly
+    {"set-brz", {Opcode::SETL, Opcode::SETLE, Opcode::SETG, Opcode::SETGE, Opcode::SETE, Opcode::SETNE}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::BRZ || w[0][0] != w[1][1])
+                return false;
+            out.push_back(MakeInstruction(MachineProgram::ComparisonBranch(w[0].opcode, false), w[1][0], w[0][1], w[0][2]));
+            return true;
+        },
+        [](const MachineInstruction* w, size_t available) -> std::string {
+            if (available < 2 || w[1].opcode != Opcode::BRZ)
+                return "";
+            return "'" + Describe(w[1]) + "' does not test what '" + Describe(w[0]) + "' set";
+        }},
+    {"bne-zero", {Opcode::BNE}, 1,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (!w[0][2].IsImmediate(0))
+                return false;
+            out.push_back(MakeInstruction(Opcode::BNZ, w[0][0], w[0][1]));
+            return true;
+        }},
+    {"imm-binop", {Opcode::IMM}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (!IsBinop(w[1].opcode))
+                return false;
+            if (w[1][1] == w[0][0]) {
+                out.push_back(MakeInstruction(w[1].opcode, w[1][0], w[0][1], w[1][2]));
+            } else if (w[1][2] == w[0][0]) {
+                out.push_back(MakeInstruction(w[1].opcode, w[1][0], w[1][1], w[0][1]));
+            } else {
+                return false;
+            }
+            return true;
+        }},
+    {"binop-mov", g_binops, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::MOV || w[0][0] != w[1][1])
+                return false;
+            out.push_back(MakeInstruction(w[0].opcode, w[1][0], w[0][1], w[0][2]));
+            return true;
+        }},
+    {"imm-brz", {Opcode::IMM}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::BRZ || !w[0][1].IsImmediate(0) || w[0][0] != w[1][1])
+                return false;
+            out.push_back(MakeInstruction(Opcode::JMP, w[1][0]));
+            return true;
+        },
+        [](const MachineInstruction* w, size_t available) -> std::string {
+            if (available < 2 || w[1].opcode != Opcode::BRZ || w[0][0] != w[1][1] || w[0][1].kind != OperandKind::IMMEDIATE)
+                return "";
+            return "'" + Describe(w[1]) + "' never branches after '" + Describe(w[0]) + "', only branches that are always taken are folded";
+        }},
+    {"llod-mov", {Opcode::LLOD}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::MOV || w[0][0] != w[1][1])
+                return false;
+            out.push_back(MakeInstruction(Opcode::LLOD, w[1][0], w[0][1], w[0][2]));
+            return true;
+        }},
+    {"lstr-llod", {Opcode::LSTR}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::LLOD || w[0][0] != w[1][1] || w[0][1] != w[1][2] || w[0][2] != w[1][0])
+                return false;
+            out.push_back(w[0]);
+            return true;
+        }},
+    {"psh-pop", {Opcode::PSH}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::POP || !w[1][0].IsRegister())
+                return false;
+            if (w[0][0] != w[1][0]) {
+                out.push_back(MakeInstruction(w[0][0].IsRegister() ? Opcode::MOV : Opcode::IMM, w[1][0], w[0][0]));
+            }
+            return true;
+        },
+        [](const MachineInstruction* w, size_t available) -> std::string {
+            if (available < 2 || w[1].opcode != Opcode::POP)
+                return "";
+            return "'" + Describe(w[1]) + "' does not pop into a register, the pair is kept";
+        }},
+    {"psh-imm-pop", {Opcode::PSH}, 3,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode != Opcode::IMM || w[2].opcode != Opcode::POP || !w[2][0].IsRegister() || !KeepsStackPair(w[1], w[2][0]))
+                return false;
+            out.push_back(MakeInstruction(w[0][0].IsRegister() ? Opcode::MOV : Opcode::IMM, w[2][0], w[0][0]));
+            out.push_back(w[1]);
+            return true;
+        }},
+    {"psh-any-pop", {Opcode::PSH}, 3,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (w[1].opcode == Opcode::IMM || w[2].opcode != Opcode::POP || !w[2][0].IsRegister() || !KeepsStackPair(w[1], w[2][0]))
+                return false;
+            out.push_back(MakeInstruction(w[0][0].IsRegister() ? Opcode::MOV : Opcode::IMM, w[2][0], w[0][0]));
+            out.push_back(w[1]);
+            return true;
+        }},
+    {"mov-binop", {Opcode::MOV}, 2,
+        [](const MachineInstruction* w, std::vector<MachineInstruction>& out) {
+            if (!IsBinop(w[1].opcode))
+                return false;
+            if (w[0][0] == w[1][1]) {
+                out.push_back(MakeInstruction(w[1].opcode, w[1][0], w[0][1], w[1][2]));
+            } else if (w[0][0] == w[1][2]) {
+                out.push_back(MakeInstruction(w[1].opcode, w[1][0], w[1][1], w[0][1]));
+            } else {
+                return false;
+            }
+            return true;
+        }},
+};
 
-    while (std::getline(ss, line)) {
-        std::istringstream lineStream(line);
-        std::string word;
-        std::vector<std::string> tokens;
+static constexpr size_t RULE_COUNT = sizeof(g_rules) / sizeof(g_rules[0]);
 
-        while (lineStream >> word) {
-            tokens.push_back(word);
-        }
-        if (!tokens.empty()) {
-            m_source.push_back(tokens);
+URCLOptimizer::URCLOptimizer()
+{
+    for (auto& rule: g_rules) {
+        for (Opcode opcode: rule.leading) {
+            m_rules[(size_t)opcode].push_back(&rule);
         }
     }
+    m_hits.assign(RULE_COUNT, 0);
+    m_windows = 0;
+    SetRemarks(nullptr);
 }
 
-// Optimizer Functions
-void URCLOptimizer::OutputEatInstruction()
+void URCLOptimizer::SetRemarks(const RemarkFilter* filter)
 {
-    m_output.push_back(EatInstruction());
+    m_remarkPassed.assign(RULE_COUNT, false);
+    m_remarkMissed.assign(RULE_COUNT, false);
+    m_anyPassed = false;
+    m_anyMissed = false;
+    m_stackPairsPassed = filter && filter->Wants(RemarkFilter::Kind::PASSED, "stack-pairs");
+    m_stackPairsMissed = filter && filter->Wants(RemarkFilter::Kind::MISSED, "stack-pairs");
+    m_tailsPassed = filter && filter->Wants(RemarkFilter::Kind::PASSED, "tail-duplicate");
+    if (!filter)
+        return;
+    for (size_t i = 0; i < RULE_COUNT; ++i) {
+        m_remarkPassed[i] = filter->Wants(RemarkFilter::Kind::PASSED, g_rules[i].name);
+        m_remarkMissed[i] = g_rules[i].missed && filter->Wants(RemarkFilter::Kind::MISSED, g_rules[i].name);
+        m_anyPassed = m_anyPassed || m_remarkPassed[i];
+        m_anyMissed = m_anyMissed || m_remarkMissed[i];
+    }
 }
 
-void URCLOptimizer::OutputPush(const std::vector<std::string>& ops)
+std::vector<Remark>& URCLOptimizer::Remarks()
 {
-    m_output.push_back(ops);
+    return m_remarks;
 }
 
-void URCLOptimizer::Skip()
+size_t URCLOptimizer::TryRules(const MachineInstruction* window, size_t available)
 {
-    m_optimized = m_lastState;
-    OutputEatInstruction();
+    for (const PeepholeRule* rule: m_rules[(size_t)window[0].opcode]) {
+        if (rule->length > available)
+            continue;
+        m_replacement.clear();
+        if (rule->rewrite(window, m_replacement)) {
+            size_t index = rule - g_rules;
+            m_hits[index] += 1;
+            if (m_anyPassed && m_remarkPassed[index]) {
+                std::string message = DescribeAll(window, rule->length);
+                message += m_replacement.empty() ? " removed" : " became " + DescribeAll(m_replacement.data(), m_replacement.size());
+                m_remarks.push_back({RemarkFilter::Kind::PASSED, rule->name, window[0].line, std::move(message)});
+            }
+            return rule->length;
+        }
+    }
+    return 0;
 }
 
-// Reserved for URCLOptimizer::CheckInstruction()
-#define StartBranchOptimize(firstOp, brzTransformed) \
-    if (first[0] == firstOp && second[0] == "brz") { \
-        m_optimized = false; \
-        bool sameReg = first[1] == second[2]; \
-        if (sameReg) { \
-            OutputPush({brzTransformed, second[1], first[2], first[3]}); \
-            Advance(2); \
-        } else { \
-            Skip(); \
-        } \
+// Near misses are only looked for in converged blocks, anything a rule could still fold is gone by then
+void URCLOptimizer::CollectMissed(const MachineInstruction* instructions, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        for (const PeepholeRule* rule: m_rules[(size_t)instructions[i].opcode]) {
+            if (!m_remarkMissed[rule - g_rules])
+                continue;
+            std::string message = rule->missed(instructions + i, size - i);
+            if (!message.empty()) {
+                m_remarks.push_back({RemarkFilter::Kind::MISSED, rule->name, instructions[i].line, std::move(message)});
+            }
+        }
     }
+}
 
-#define BranchOptimize(firstOp, brzTransformed) \
-    else StartBranchOptimize(firstOp, brzTransformed) 
-
-void URCLOptimizer::CheckInstruction()
+// Peepholes never look past a label or a branch, so each block converges on its own.
+// Instructions form a linked list over the block's slots, a rewrite overwrites its window
+// in place and only the windows that could now overlap it are queued again.
+void URCLOptimizer::OptimizeBlock(BasicBlock& block)
 {
-    m_lastState = m_optimized;
-    if (m_index + 1 >= m_source.size()) {
-        OutputEatInstruction();
+    auto& instructions = block.instructions;
+    uint32_t size = instructions.size();
+    if (size == 0)
         return;
+
+    uint32_t* next = m_arena.Allocate<uint32_t>(size);
+    uint32_t* prev = m_arena.Allocate<uint32_t>(size);
+    bool* alive = m_arena.Allocate<bool>(size);
+    bool* queued = m_arena.Allocate<bool>(size);
+    uint32_t* worklist = m_arena.Allocate<uint32_t>(size);
+    size_t pending = 0;
+
+    // popped front to back, like a single pass over the block
+    for (uint32_t i = 0; i < size; ++i) {
+        next[i] = i + 1 < size ? i + 1 : NO_INSTRUCTION;
+        prev[i] = i > 0 ? i - 1 : NO_INSTRUCTION;
+        alive[i] = true;
+        queued[i] = true;
+        worklist[pending++] = size - 1 - i;
     }
 
-    auto& first = RequestInstruction(0);
-    auto& second = RequestInstruction(1);
-    auto& third = RequestInstruction(2);
-
-    // Ugly peephole optimizations here, ill make this readable in the future..
-    // Removes basic redundant operations (A Peephole Optimizer)
-    StartBranchOptimize("setl", "bge")
-    BranchOptimize("setle", "brg")
-    BranchOptimize("setg", "ble")
-    BranchOptimize("setge", "brl")
-    BranchOptimize("sete", "bne")
-    BranchOptimize("setne", "bre")
-
-    else if (first[0] == "bne") {
-        m_optimized = false;
-
-        if (first[3] == "0") {
-            OutputPush({"bnz", first[1], first[2]});
-            Advance();
-        } else {
-            Skip();
+    auto enqueue = [&](uint32_t i) {
+        if (i != NO_INSTRUCTION && !queued[i]) {
+            queued[i] = true;
+            worklist[pending++] = i;
         }
-    } else if (first[0] == "imm" && IsBinop(second[0])) {
-        m_optimized = false;
-        bool usesRegB = (second[2] == first[1]);
-        bool usesRegC = (second[3] == first[1]);
-
-        if (usesRegB) {
-            OutputPush({second[0], second[1], first[2], second[3]});
-            Advance(2);
-        } else if (usesRegC) {
-            OutputPush({second[0], second[1], second[2], first[2]});
-            Advance(2);
-        } else {
-            Skip();
+    };
+
+    while (pending) {
+        uint32_t start = worklist[--pending];
+        queued[start] = false;
+        if (!alive[start])
+            continue;
+        m_windows += 1;
+
+        uint32_t slots[MAX_WINDOW];
+        MachineInstruction window[MAX_WINDOW];
+        size_t available = 0;
+        for (uint32_t i = start; i != NO_INSTRUCTION && available < MAX_WINDOW; i = next[i]) {
+            slots[available] = i;
+            window[available++] = instructions[i];
         }
-    } else if (IsBinop(first[0]) && second[0] == "mov") {
-        m_optimized = false;
-        bool sameReg = first[1] == second[2];
 
-        if (sameReg) {
-            OutputPush({first[0], second[1], first[2], first[3]});
-            Advance(2);
-        } else {
-            Skip();
-        }
-    } else if (first[0] == "imm" && second[0] == "brz") {
-        m_optimized = false;
-        bool isZero = first[2] == "0";
-        bool sameReg = first[1] == second[2];
-
-        if (isZero && sameReg) {
-            OutputPush({"jmp", second[1]});
-            Advance(2);
-        } else {
-            Skip();
-        }
-    } else if (first[0] == "llod" && second[0] == "mov") {
-        m_optimized = false;
-        bool sameReg = first[1] == second[2];
+        size_t consumed = TryRules(window, available);
+        if (!consumed)
+            continue;
 
-        if (sameReg) {
-            OutputPush({"llod", second[1], first[2], first[3]});
-            Advance(2);
-        } else {
-            Skip();
+        // the replacement is never longer than the window, leftover slots are unlinked
+        size_t written = m_replacement.size();
+        for (size_t i = 0; i < written; ++i) {
+            instructions[slots[i]] = m_replacement[i];
+            instructions[slots[i]].line = window[i].line;
         }
-    } else if (first[0] == "lstr" && second[0] == "llod") {
-        m_optimized = false;
-        bool sameBase = first[1] == second[2];
-        bool sameOffset = first[2] == second[3];
-        bool sameReg = first[3] ==  second[1];
-
-        if (sameBase && sameOffset && sameReg) {
-            Advance(2);
-            OutputPush(first);
-        } else {
-            Skip();
+        uint32_t before = prev[start];
+        for (size_t i = written; i < consumed; ++i) {
+            uint32_t slot = slots[i];
+            alive[slot] = false;
+            if (prev[slot] != NO_INSTRUCTION)
+                next[prev[slot]] = next[slot];
+            if (next[slot] != NO_INSTRUCTION)
+                prev[next[slot]] = prev[slot];
         }
-    } else if (first[0] == "psh" && second[0] == "pop") {
-        m_optimized = false;
-        std::string psh_a = first[1];
-        std::string pop_a = second[1];
-
-        if (psh_a == pop_a && pop_a[0] == 'r') {
-            Advance(2);
-        } else if (pop_a[0] == 'r' && psh_a[0] != 'r') {
-            OutputPush({"imm", pop_a, psh_a});
-            Advance(2);
+
+        // revisit the rewrite itself, then every window that starts early enough to reach it
+        enqueue(written ? start : (before != NO_INSTRUCTION ? next[before] : next[slots[consumed - 1]]));
+        for (size_t i = 1; i < MAX_WINDOW && before != NO_INSTRUCTION; ++i) {
+            enqueue(before);
+            before = prev[before];
         }
-    } else if (first[0] == "psh" && second[0] == "imm" && third[0] == "pop") {
-        m_optimized = false;
-        std::string psh_a = first[1];
-        std::string pop_a = third[1];
+    }
 
-        if (pop_a[0] == psh_a[0] && pop_a[0] == 'r') {
-            OutputPush({"mov", pop_a, psh_a});
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+        if (alive[i]) {
+            instructions[kept++] = instructions[i];
         }
-        if (pop_a[0] != psh_a[0] && pop_a[0] == 'r') {
-            OutputPush({"imm", pop_a, psh_a});
+    }
+    instructions.resize(kept);
+}
+
+void URCLOptimizer::Optimize(MachineProgram& program)
+{
+    for (auto& block: program.Blocks()) {
+        OptimizeBlock(block);
+        m_arena.Reset();
+    }
+}
+
+// Stack Pairs, a psh and the pop that takes its value back. Pairs nested between them move sp the same
+// whether or not the outer pair is there, so the pair is a plain copy unless something between touches
+// sp some other way or uses the popped register. `dead` instructions were already folded away
+struct StackPair
+{
+    size_t pop;     // the matching pop, `size` when sp is used some other way first
+    size_t blocker; // what keeps the pair from being a plain copy, `size` when nothing does
+    bool renamable; // the blocker only uses the popped register, a scratch register can carry the value
+};
+
+static constexpr int32_t FIRST_SCRATCH = 3;
+static constexpr int32_t LAST_SCRATCH = 19;
+
+static size_t FindUse(const MachineInstruction* instructions, const std::vector<bool>& dead, size_t first, size_t last, const Operand& operand)
+{
+    for (size_t i = first + 1; i < last; ++i) {
+        if (dead[i])
+            continue;
+        for (size_t op = 0; op < instructions[i].count; ++op) {
+            if (instructions[i][op] == operand)
+                return i;
         }
-        OutputPush(second);
-        Advance(3);
-    } else if (first[0] == "psh" &&
-         second[0] != "psh" &&
-         second[0] != "pop" &&
-         third[0]  == "pop")
-    {
-        m_optimized = false;
-        OutputPush({"mov", third[1], first[1]});
-        OutputPush(second);
-        Advance(3);
-
-    } else if (first[0] == "mov" && IsBinop(second[0])) {
-        m_optimized = false;
-        bool usesRegB = first[1] == second[2];
-        bool usesRegC = first[1] == second[3];
-        
-        if (usesRegB) {
-            OutputPush({second[0], second[1], first[2], second[3]});
-            Advance(2);
-        } else if (usesRegC) {
-            OutputPush({second[0], second[1], second[2], first[2]});
-            Advance(2);
-        } else {
-            Skip();
+    }
+    return last;
+}
+
+static StackPair FindStackPair(const MachineInstruction* instructions, const std::vector<bool>& dead, size_t psh, size_t size)
+{
+    StackPair pair = {size, size, false};
+    size_t depth = 0;
+    for (size_t i = psh + 1; i < size; ++i) {
+        if (dead[i])
+            continue;
+        Opcode opcode = instructions[i].opcode;
+        if (opcode == Opcode::CAL || opcode == Opcode::RAW || UsesStackPointer(instructions[i]))
+            return pair;
+        if (opcode == Opcode::PSH) {
+            depth += 1;
+        } else if (opcode == Opcode::POP) {
+            if (depth == 0) {
+                pair.pop = i;
+                break;
+            }
+            depth -= 1;
         }
+    }
+    if (pair.pop == size)
+        return pair;
+
+    // named operands may be ports or macros, only what is plainly a value is copied
+    const Operand& pushed = instructions[psh][0];
+    const Operand& popped = instructions[pair.pop][0];
+    if (!popped.IsRegister()) {
+        pair.blocker = pair.pop;
+    } else if (pushed.kind == OperandKind::NAMED || UsesStackPointer(instructions[psh])) {
+        pair.blocker = psh;
     } else {
-        OutputEatInstruction();
+        size_t use = FindUse(instructions, dead, psh, pair.pop, popped);
+        if (use != pair.pop) {
+            pair.blocker = use;
+            pair.renamable = true;
+        }
     }
+    return pair;
 }
 
+static size_t LiveBetween(const std::vector<bool>& dead, size_t first, size_t last)
+{
+    size_t count = 0;
+    for (size_t i = first + 1; i < last; ++i) {
+        count += dead[i] ? 0 : 1;
+    }
+    return count;
+}
 
-std::string URCLOptimizer::RebuildOutput()
+// Scratch registers are ones the function never mentions, there are none when raw assembly might
+void URCLOptimizer::FindScratchRegisters(MachineProgram& program)
 {
-    std::string output;
-    std::vector<std::vector<std::string>> toReplace;
-    bool wasLabel = false;
-
-    for (auto& out: m_output) {
-        // Is Label
-        if (out[0][0] == '.') {
-            if (!wasLabel) {
-                output += out[0];
-                wasLabel = true;
-                toReplace.push_back({out[0]});
-            } else {
-                toReplace.back().push_back(out[0]);
+    bool used[LAST_SCRATCH + 1] = {};
+    m_scratch.clear();
+    for (auto& block: program.Blocks()) {
+        for (auto& instruction: block.instructions) {
+            if (instruction.opcode == Opcode::RAW)
+                return;
+            for (size_t i = 0; i < instruction.count; ++i) {
+                if (instruction[i].IsRegister() && instruction[i].value >= 0 && instruction[i].value <= LAST_SCRATCH) {
+                    used[instruction[i].value] = true;
+                }
+            }
+        }
+    }
+    for (int32_t r = FIRST_SCRATCH; r <= LAST_SCRATCH; ++r) {
+        if (!used[r]) {
+            m_scratch.push_back(r);
+        }
+    }
+}
+
+// Innermost pairs go first. A plain copy turns the psh into the copy and drops the pop, a pair whose
+// register is used in between goes through a scratch register instead, both stay but never touch memory
+void URCLOptimizer::FoldStackPairs(MachineProgram& program)
+{
+    FindScratchRegisters(program);
+    for (auto& block: program.Blocks()) {
+        auto& instructions = block.instructions;
+        size_t size = instructions.size();
+        m_dead.assign(size, false);
+        bool removed = false;
+
+        for (size_t i = size; i-- > 0;) {
+            if (instructions[i].opcode != Opcode::PSH)
                 continue;
+            StackPair pair = FindStackPair(instructions.data(), m_dead, i, size);
+            if (pair.pop == size || (pair.blocker != size && !pair.renamable))
+                continue;
+
+            Operand pushed = instructions[i][0];
+            Operand popped = instructions[pair.pop][0];
+            Operand scratch;
+            if (pair.blocker != size) {
+                for (int32_t r: m_scratch) {
+                    if (FindUse(instructions.data(), m_dead, i, pair.pop, Operand::Register(r)) == pair.pop) {
+                        scratch = Operand::Register(r);
+                        break;
+                    }
+                }
+                if (scratch.kind == OperandKind::NONE)
+                    continue;
             }
-        } else {
-            if (wasLabel && toReplace.back().size() == 1) {
-                toReplace.pop_back();
+
+            std::string message;
+            if (m_stackPairsPassed) {
+                message = "'" + Describe(instructions[i]) + "' and '" + Describe(instructions[pair.pop]) + "' " +
+                          std::to_string(LiveBetween(m_dead, i, pair.pop)) + " instructions apart";
             }
-            wasLabel = false;
-            output += "    ";
-            for (std::string& ops: out) {
-                output += ops + " ";
+
+            uint32_t pshLine = instructions[i].line;
+            uint32_t popLine = instructions[pair.pop].line;
+            Opcode copy = pushed.IsRegister() ? Opcode::MOV : Opcode::IMM;
+            if (scratch.kind != OperandKind::NONE) {
+                instructions[i] = MakeInstruction(copy, scratch, pushed);
+                instructions[pair.pop] = MakeInstruction(Opcode::MOV, popped, scratch);
+                instructions[pair.pop].line = popLine;
+                message += " became '" + Describe(instructions[i]) + "' and '" + Describe(instructions[pair.pop]) + "'";
+            } else if (pushed == popped) {
+                m_dead[i] = true;
+                m_dead[pair.pop] = true;
+                message += " removed";
+            } else {
+                instructions[i] = MakeInstruction(copy, popped, pushed);
+                m_dead[pair.pop] = true;
+                message += " became '" + Describe(instructions[i]) + "'";
+            }
+            instructions[i].line = pshLine;
+            removed = removed || m_dead[pair.pop];
+
+            if (m_stackPairsPassed) {
+                m_remarks.push_back({RemarkFilter::Kind::PASSED, "stack-pairs", pshLine, std::move(message)});
             }
         }
-        output += '\n';
+
+        if (!removed)
+            continue;
+        size_t kept = 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (!m_dead[i]) {
+                instructions[kept++] = instructions[i];
+            }
+        }
+        instructions.resize(kept);
     }
+}
+
+// Only returns are copied, they never fall through into whatever follows the copy
+static constexpr size_t MAX_TAIL = 3;
 
-    for (auto& labels: toReplace) {
-        std::string& real = labels[0];
-        for (size_t i = 1; i < labels.size(); i++) {
-            replaceAll(output, labels[i], real);
+static bool IsTail(const MachineInstructions& instructions)
+{
+    if (instructions.empty() || instructions.size() > MAX_TAIL)
+        return false;
+    Opcode last = instructions.back().opcode;
+    if (last != Opcode::RET && last != Opcode::HLT)
+        return false;
+    for (auto& instruction: instructions) {
+        if (instruction.opcode == Opcode::RAW)
+            return false;
+        for (size_t i = 0; i < instruction.count; ++i) {
+            if (instruction[i].kind == OperandKind::LABEL)
+                return false;
+        }
+    }
+    return true;
+}
+
+void URCLOptimizer::DuplicateTails(MachineProgram& program)
+{
+    auto& blocks = program.Blocks();
+
+    // labels with no instructions after them in their own block belong to the next block that has some
+    m_blockAt.clear();
+    m_pendingLabels.clear();
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        m_pendingLabels.insert(m_pendingLabels.end(), blocks[i].labels.begin(), blocks[i].labels.end());
+        if (blocks[i].instructions.empty())
+            continue;
+        for (uint32_t label: m_pendingLabels) {
+            m_blockAt[program.FindLabel(label)] = i;
         }
+        m_pendingLabels.clear();
     }
 
-    return output;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        auto& instructions = blocks[i].instructions;
+        if (instructions.empty() || instructions.back().opcode != Opcode::JMP || instructions.back()[0].kind != OperandKind::LABEL)
+            continue;
+        auto target = m_blockAt.find(program.FindLabel(instructions.back()[0].value));
+        if (target == m_blockAt.end() || target->second == i || !IsTail(blocks[target->second].instructions))
+            continue;
+
+        const MachineInstructions& tail = blocks[target->second].instructions;
+        MachineInstruction jump = instructions.back();
+        instructions.pop_back();
+        for (auto& instruction: tail) {
+            instructions.push_back(instruction);
+            instructions.back().line = jump.line;
+        }
+        if (m_tailsPassed) {
+            m_remarks.push_back({RemarkFilter::Kind::PASSED, "tail-duplicate", jump.line,
+                "'" + Describe(jump) + "' became a copy of its target, " + DescribeAll(tail.data(), tail.size())});
+        }
+    }
 }
 
-std::string URCLOptimizer::Optimize(const std::string& assembly)
+void URCLOptimizer::ExplainStackPairs(const MachineInstruction* instructions, size_t size, bool folded)
 {
-    m_index = 0;
-    m_optimized = false;
-    m_source.clear(); 
-    m_output.clear(); 
-    SliceAssembly(assembly);
-
-    do {
-        m_index = 0;
-        m_optimized = true;
-        std::vector<std::vector<std::string>> next_source = std::move(m_output);
-        m_output.clear();
-
-        if (!next_source.empty()) {
-            m_source = std::move(next_source);
+    m_dead.assign(size, false);
+    for (size_t i = 0; i < size; ++i) {
+        if (instructions[i].opcode != Opcode::PSH)
+            continue;
+        StackPair pair = FindStackPair(instructions, m_dead, i, size);
+        // the peephole rules are the ones that fold pairs this close
+        if (pair.pop == size || pair.pop - i <= 2)
+            continue;
+
+        std::string message = "'" + Describe(instructions[i]) + "' is popped by '" + Describe(instructions[pair.pop]) + "' " +
+                              std::to_string(pair.pop - i - 1) + " instructions later";
+        if (!folded) {
+            message += ", only -O2 and -Os fold pairs that far apart";
+        } else if (pair.renamable) {
+            message += ", '" + Describe(instructions[pair.blocker]) + "' uses the register in between and no scratch register is free";
+        } else if (pair.blocker != size) {
+            message += ", '" + Describe(instructions[pair.blocker]) + "' keeps it from being a copy";
+        } else {
+            continue;
         }
+        m_remarks.push_back({RemarkFilter::Kind::MISSED, "stack-pairs", instructions[i].line, std::move(message)});
+    }
+}
 
-        while (NotEnd()) {
-            CheckInstruction();
+void URCLOptimizer::ExplainMissed(MachineProgram& program, bool peephole, bool stackPairs)
+{
+    for (auto& block: program.Blocks()) {
+        if (peephole && m_anyMissed) {
+            CollectMissed(block.instructions.data(), block.instructions.size());
+        }
+        if (m_stackPairsMissed) {
+            ExplainStackPairs(block.instructions.data(), block.instructions.size(), stackPairs);
         }
+    }
+}
+
+void URCLOptimizer::MergeStats(const URCLOptimizer& other)
+{
+    for (size_t i = 0; i < RULE_COUNT; ++i) {
+        m_hits[i] += other.m_hits[i];
+    }
+    m_windows += other.m_windows;
+}
+
+size_t URCLOptimizer::Windows() const
+{
+    return m_windows;
+}
 
-    } while (!m_optimized);
+size_t URCLOptimizer::Rewrites() const
+{
+    size_t rewrites = 0;
+    for (size_t hits: m_hits) {
+        rewrites += hits;
+    }
+    return rewrites;
+}
 
-    return RebuildOutput();
-}
\ No newline at end of file
+void URCLOptimizer::PrintStats(std::ostream& stream) const
+{
+    for (size_t i = 0; i < RULE_COUNT; ++i) {
+        stream << "[PEEPHOLE]: " << g_rules[i].name << ": " << m_hits[i] << '\n';
+    }
+}
@@ -1,35 +1,75 @@
-
 #pragma once
 
-#include <string>
-#include <vector>
+#include "machine_ir.hpp"
+#include "remarks.hpp"
+
+#include <iostream>
+#include <unordered_map>
+
+// One peephole pattern, matches `length` instructions starting with one of its leading opcodes
+struct PeepholeRule
+{
+    const char* name;
+    std::vector<Opcode> leading;
+    size_t length;
+    // appends the replacement to `out` and returns true when the window matches
+    bool (*rewrite)(const MachineInstruction* window, std::vector<MachineInstruction>& out);
+    // why a window that almost matched was left alone, empty when it was nothing like one. Only asked
+    // for -Rpass-missed once the block has converged, so it may look past `length` up to `available`
+    std::string (*missed)(const MachineInstruction* window, size_t available) = nullptr;
+};
 
 class URCLOptimizer 
 {
 public:
-    std::string Optimize(const std::string& assembly);
+    URCLOptimizer();
+
+    // the peephole pass, every block is rewritten until no rule matches
+    void Optimize(MachineProgram& program);
+    // folds psh/pop pairs too far apart for the rules into copies, for -O2 and -Os
+    void FoldStackPairs(MachineProgram& program);
+    // a jump to a short block that returns becomes a copy of that block, for -O2
+    void DuplicateTails(MachineProgram& program);
+    // near misses of the passes that ran, looked for once the whole pipeline is done
+    void ExplainMissed(MachineProgram& program, bool peephole, bool stackPairs);
+    void PrintStats(std::ostream& stream) const;
+    // adds the rule hits of an optimizer that ran on another thread
+    void MergeStats(const URCLOptimizer& other);
+    // windows the worklist tried and how many of them a rule rewrote, for -ftime-report
+    size_t Windows() const;
+    size_t Rewrites() const;
+    // collects a Remark for every rewrite and near miss the filter wants, until Remarks() is cleared
+    void SetRemarks(const RemarkFilter* filter);
+    std::vector<Remark>& Remarks();
 
 private:
-    std::vector<std::vector<std::string>> m_source;
-    std::vector<std::vector<std::string>> m_output;
-    std::vector<std::string> m_dummy = {"dummy"};
-    size_t m_index;
-    bool m_lastState;
-    bool m_optimized;
-
-    // Source Functions
-    void Advance(int i = 1);
-    bool NotEnd();
-    std::vector<std::string>& EatInstruction();
-    std::vector<std::string>& RequestInstruction(int i);
-
-    // Initial Functions
-    void SliceAssembly(const std::string& assembly);
+    // Optimizer Info
+    Arena m_arena;
+    std::vector<const PeepholeRule*> m_rules[(size_t)Opcode::RAW + 1];
+    std::vector<size_t> m_hits;
+    size_t m_windows;
+    std::vector<MachineInstruction> m_replacement;
+
+    // Remark Info, by rule index
+    std::vector<bool> m_remarkPassed;
+    std::vector<bool> m_remarkMissed;
+    bool m_anyPassed;
+    bool m_anyMissed;
+    bool m_stackPairsPassed;
+    bool m_stackPairsMissed;
+    bool m_tailsPassed;
+    std::vector<Remark> m_remarks;
+
+    // Pass Info
+    std::vector<bool> m_dead;
+    std::vector<int32_t> m_scratch;
+    std::vector<uint32_t> m_pendingLabels;
+    std::unordered_map<uint32_t, size_t> m_blockAt;
 
     // Optimizer Functions
-    void OutputPush(const std::vector<std::string>& ops);
-    void OutputEatInstruction();
-    void CheckInstruction();
-    void Skip();
-    std::string RebuildOutput();
-};
\ No newline at end of file
+    void OptimizeBlock(BasicBlock& block);
+    size_t TryRules(const MachineInstruction* window, size_t available);
+    void CollectMissed(const MachineInstruction* instructions, size_t size);
+    void FindScratchRegisters(MachineProgram& program);
+    void ExplainStackPairs(const MachineInstruction* instructions, size_t size, bool folded);
+};